@@ -2,8 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <unistd.h>
+#include "bounded_buffer.h"
 
 #define MAX_STRING_LENGTH 1000
 #define NUM_TYPES 3
@@ -16,16 +16,6 @@ typedef struct {
     int queue_size;
 } Producer;
 
-typedef struct {
-    char **buffer;
-    int size;
-    int in;
-    int out;
-    sem_t full;
-    sem_t empty;
-    pthread_mutex_t mutex;
-} BoundedBuffer;
-
 typedef struct {
     int id;
     int num_products;
@@ -33,8 +23,8 @@ typedef struct {
 } ProducerArgs;
 
 typedef struct {
-    BoundedBuffer *producer_queues;
-    BoundedBuffer *dispatcher_queues;
+    BoundedBuffer **producer_queues;
+    BoundedBuffer **dispatcher_queues;
     int num_producers;
 } DispatcherArgs;
 
@@ -48,135 +38,11 @@ typedef struct {
     BoundedBuffer *shared_queue;
 } ScreenManagerArgs;
 
-BoundedBuffer *create_bounded_buffer(int size);
-void insert_bounded_buffer(BoundedBuffer *bb, const char *str);
-char *remove_bounded_buffer(BoundedBuffer *bb);
-void destroy_bounded_buffer(BoundedBuffer *bb);
-
 void *producer_thread(void *args);
 void *dispatcher_thread(void *args);
 void *co_editor_thread(void *args);
 void *screen_manager_thread(void *args);
 
-BoundedBuffer *create_bounded_buffer(int size) {
-    BoundedBuffer *bb = (BoundedBuffer *)malloc(sizeof(BoundedBuffer));
-    if (bb == NULL) {
-        perror("Error allocating BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    bb->buffer = (char **)malloc(size * sizeof(char *));
-    if (bb->buffer == NULL) {
-        perror("Error allocating buffer in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    for (int i = 0; i < size; i++) {
-        bb->buffer[i] = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
-        if (bb->buffer[i] == NULL) {
-            perror("Error allocating buffer element in BoundedBuffer");
-            exit(EXIT_FAILURE);
-        }
-    }
-    
-    bb->size = size;
-    bb->in = 0;
-    bb->out = 0;
-    
-    if (sem_init(&bb->full, 0, 0) != 0) {
-        perror("Error initializing full semaphore in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_init(&bb->empty, 0, size) != 0) {
-        perror("Error initializing empty semaphore in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_init(&bb->mutex, NULL) != 0) {
-        perror("Error initializing mutex in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    return bb;
-}
-
-void insert_bounded_buffer(BoundedBuffer *bb, const char *str) {
-    if (sem_wait(&bb->empty) != 0) {
-        perror("Error waiting on empty semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_lock(&bb->mutex) != 0) {
-        perror("Error locking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    strncpy(bb->buffer[bb->in], str, MAX_STRING_LENGTH);
-    bb->in = (bb->in + 1) % bb->size;
-    
-    if (pthread_mutex_unlock(&bb->mutex) != 0) {
-        perror("Error unlocking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_post(&bb->full) != 0) {
-        perror("Error posting to full semaphore");
-        exit(EXIT_FAILURE);
-    }
-}
-
-char *remove_bounded_buffer(BoundedBuffer *bb) {
-    if (sem_wait(&bb->full) != 0) {
-        perror("Error waiting on full semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_lock(&bb->mutex) != 0) {
-        perror("Error locking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    char *str = strdup(bb->buffer[bb->out]); // Make a copy of the string to return
-    bb->out = (bb->out + 1) % bb->size;
-    
-    if (pthread_mutex_unlock(&bb->mutex) != 0) {
-        perror("Error unlocking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_post(&bb->empty) != 0) {
-        perror("Error posting to empty semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    return str;
-}
-
-void destroy_bounded_buffer(BoundedBuffer *bb) {
-    for (int i = 0; i < bb->size; i++) {
-        free(bb->buffer[i]);
-    }
-    free(bb->buffer);
-    
-    if (sem_destroy(&bb->full) != 0) {
-        perror("Error destroying full semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_destroy(&bb->empty) != 0) {
-        perror("Error destroying empty semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_destroy(&bb->mutex) != 0) {
-        perror("Error destroying mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    free(bb);
-}
-
 void *producer_thread(void *args) {
     ProducerArgs *p_args = (ProducerArgs *)args;
     const char *types[] = {"SPORTS", "NEWS", "WEATHER"};
@@ -197,30 +63,29 @@ void *dispatcher_thread(void *args) {
     int num_done = 0;
     while (num_done < d_args->num_producers) {
         for (int i = 0; i < d_args->num_producers; i++) {
-            if (sem_trywait(&d_args->producer_queues[i].full) == 0) {
-                char *message = remove_bounded_buffer(&d_args->producer_queues[i]);
+            char *message = try_remove_bounded_buffer(d_args->producer_queues[i]);
+            if (message != NULL) {
                 if (strcmp(message, "DONE") == 0) {
                     num_done++;
                 } else {
                     char type[MAX_STRING_LENGTH];
                     sscanf(message, "%*s %*d %s %*d", type);
                     if (strcmp(type, "SPORTS") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[0], message);
+                        insert_bounded_buffer(d_args->dispatcher_queues[0], message);
                     } else if (strcmp(type, "NEWS") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[1], message);
+                        insert_bounded_buffer(d_args->dispatcher_queues[1], message);
                     } else if (strcmp(type, "WEATHER") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[2], message);
+                        insert_bounded_buffer(d_args->dispatcher_queues[2], message);
                     }
-                    sem_post(&d_args->producer_queues[i].full);
-                    printf("Dispatcher processed message: %s\n", message);
-                    free(message); // Free the allocated message memory
                 }
+                printf("Dispatcher processed message: %s\n", message);
+                free(message); // Free the allocated message memory
             }
         }
     }
     // Signal end of dispatching to co-editors
     for (int i = 0; i < NUM_TYPES; i++) {
-        insert_bounded_buffer(&d_args->dispatcher_queues[i], "DONE");
+        insert_bounded_buffer(d_args->dispatcher_queues[i], "DONE");
         printf("Dispatcher sent DONE to co-editor %d\n", i);
     }
     return NULL;
@@ -322,17 +187,17 @@ int main(int argc, char *argv[]) {
     int BUFFER_SIZE = 100;
     int NUM_PRODUCERS = num_producers;
     
-    BoundedBuffer producer_queues[NUM_PRODUCERS];
+    BoundedBuffer *producer_queues[NUM_PRODUCERS];
     for (int i = 0; i < NUM_PRODUCERS; i++) {
-        producer_queues[i] = *create_bounded_buffer(BUFFER_SIZE);
+        producer_queues[i] = create_bounded_buffer(BUFFER_SIZE);
     }
     
-    BoundedBuffer dispatcher_queues[NUM_TYPES];
+    BoundedBuffer *dispatcher_queues[NUM_TYPES];
     for (int i = 0; i < NUM_TYPES; i++) {
-        dispatcher_queues[i] = *create_bounded_buffer(BUFFER_SIZE);
+        dispatcher_queues[i] = create_bounded_buffer(BUFFER_SIZE);
     }
     
-    BoundedBuffer shared_queue = *create_bounded_buffer(BUFFER_SIZE * NUM_PRODUCERS);
+    BoundedBuffer *shared_queue = create_bounded_buffer(BUFFER_SIZE * NUM_PRODUCERS);
     
     pthread_t producers[NUM_PRODUCERS];
     ProducerArgs producer_args[NUM_PRODUCERS];
@@ -340,7 +205,7 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < NUM_PRODUCERS; i++) {
         producer_args[i].id = producers_array[i].id;
         producer_args[i].num_products = producers_array[i].number;
-        producer_args[i].queue = &producer_queues[i];
+        producer_args[i].queue = producer_queues[i];
         if (pthread_create(&producers[i], NULL, producer_thread, (void *)&producer_args[i]) != 0) {
             perror("Error creating producer thread");
             exit(EXIT_FAILURE);
@@ -359,8 +224,8 @@ int main(int argc, char *argv[]) {
     
     const char *types[] = {"SPORTS", "NEWS", "WEATHER"};
     for (int i = 0; i < NUM_TYPES; i++) {
-        co_editor_args[i].dispatcher_queue = &dispatcher_queues[i];
-        co_editor_args[i].shared_queue = &shared_queue;
+        co_editor_args[i].dispatcher_queue = dispatcher_queues[i];
+        co_editor_args[i].shared_queue = shared_queue;
         co_editor_args[i].type = types[i];
         if (pthread_create(&co_editors[i], NULL, co_editor_thread, (void *)&co_editor_args[i]) != 0) {
             perror("Error creating co-editor thread");
@@ -368,7 +233,7 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    ScreenManagerArgs screen_manager_args = {&shared_queue};
+    ScreenManagerArgs screen_manager_args = {shared_queue};
     pthread_t screen_manager;
     if (pthread_create(&screen_manager, NULL, screen_manager_thread, (void *)&screen_manager_args) != 0) {
         perror("Error creating screen manager thread");
@@ -400,14 +265,14 @@ int main(int argc, char *argv[]) {
     }
     
     for (int i = 0; i < NUM_PRODUCERS; i++) {
-        destroy_bounded_buffer(&producer_queues[i]);
+        destroy_bounded_buffer(producer_queues[i]);
     }
     
     for (int i = 0; i < NUM_TYPES; i++) {
-        destroy_bounded_buffer(&dispatcher_queues[i]);
+        destroy_bounded_buffer(dispatcher_queues[i]);
     }
     
-    destroy_bounded_buffer(&shared_queue);
+    destroy_bounded_buffer(shared_queue);
     
     return 0;
 }
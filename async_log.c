@@ -0,0 +1,273 @@
+#include "async_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_SIZE (64 * 1024)       // Bytes of pending log text per thread
+#define MAX_RECORD 512              // Longer messages are truncated
+#define WRITE_CHUNK (256 * 1024)    // Size of the writes the writer thread issues
+#define IDLE_WAIT_NS 5000000        // How long the writer sleeps when every ring is empty
+
+// Single producer, single consumer byte ring: the owning thread appends whole records and publishes
+// them by moving head, the writer thread consumes them and moves tail. Both only ever grow.
+// When the owning thread exits it marks the ring retired, and the writer frees it once drained.
+typedef struct LogRing {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_int retired;
+    struct LogRing *next;       // Written by the pushing thread before the ring is published, then by the writer only
+    char data[RING_SIZE];
+} LogRing;
+
+atomic_int async_log_level = LOG_LEVEL_INFO;
+
+static _Atomic(LogRing *) rings;    // Every registered ring, pushed at the front
+static atomic_int running;
+static atomic_int generation;       // Bumped on stop, so threads register a fresh ring after a restart
+static int out_fd = STDOUT_FILENO;
+static pthread_t writer;
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+
+static _Thread_local LogRing *own_ring;
+static _Thread_local int own_generation;
+static pthread_key_t ring_key;      // Holds each thread's ring, its destructor retires the ring at thread exit
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void write_all(const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(out_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error writing log");
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+static void wake_writer(void)
+{
+    pthread_mutex_lock(&wake_mutex);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_mutex);
+}
+
+static void retire_ring(void *ring)
+{
+    // A ring of an earlier generation was already freed by async_log_stop
+    if (own_generation == atomic_load(&generation)) {
+        atomic_store_explicit(&((LogRing *)ring)->retired, 1, memory_order_release);
+    }
+    own_ring = NULL;
+}
+
+static void create_ring_key(void)
+{
+    if (pthread_key_create(&ring_key, retire_ring) != 0) {
+        perror("Error creating log ring key");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static LogRing *register_ring(void)
+{
+    LogRing *ring = (LogRing *)aligned_alloc(64, sizeof(LogRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->retired, 0);
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_setspecific(ring_key, ring);
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring)) {
+    }
+    own_ring = ring;
+    own_generation = atomic_load(&generation);
+    return ring;
+}
+
+void async_log_write(const char *format, ...)
+{
+    char record[MAX_RECORD];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(record, sizeof(record), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if (length >= MAX_RECORD) {
+        length = MAX_RECORD - 1;
+    }
+
+    LogRing *ring = NULL;
+    if (atomic_load_explicit(&running, memory_order_acquire)) {
+        ring = own_ring != NULL && own_generation == atomic_load(&generation) ? own_ring : register_ring();
+    }
+    if (ring == NULL) {
+        // No writer thread, write through
+        write_all(record, (size_t)length);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (RING_SIZE - (head - atomic_load_explicit(&ring->tail, memory_order_acquire)) < (size_t)length) {
+        // Full: the writer is behind, nudge it and wait instead of dropping the message
+        wake_writer();
+        sched_yield();
+    }
+
+    size_t offset = head % RING_SIZE;
+    size_t first = (size_t)length < RING_SIZE - offset ? (size_t)length : RING_SIZE - offset;
+    memcpy(ring->data + offset, record, first);
+    memcpy(ring->data, record + first, (size_t)length - first);
+    atomic_store_explicit(&ring->head, head + (size_t)length, memory_order_release);
+
+    if (head % (RING_SIZE / 2) + (size_t)length >= RING_SIZE / 2) {
+        // Crossed a half of the ring, do not wait for the writer's idle timeout
+        wake_writer();
+    }
+}
+
+// Take a drained, retired ring out of the list. prev is the ring before it, NULL if it was first when the
+// list was read; only then can a newly registered ring be in front of it, and it is left for the next pass.
+static int unlink_ring(LogRing *prev, LogRing *ring)
+{
+    if (prev != NULL) {
+        prev->next = ring->next;
+        return 1;
+    }
+    LogRing *expected = ring;
+    return atomic_compare_exchange_strong(&rings, &expected, ring->next);
+}
+
+// Move every published record into out and write it, return whether anything was written
+static int drain(char *out)
+{
+    size_t used = 0;
+    int drained = 0;
+    LogRing *prev = NULL;
+    for (LogRing *ring = atomic_load(&rings), *next; ring != NULL; ring = next) {
+        next = ring->next;
+        // Read before head, so a retired ring's last records are drained in this pass
+        int retired = atomic_load_explicit(&ring->retired, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        // Copy up to head in one go, flushing when out fills, so records of different threads never interleave
+        while (tail != head) {
+            size_t offset = tail % RING_SIZE;
+            size_t length = head - tail;
+            if (length > RING_SIZE - offset) {
+                length = RING_SIZE - offset;
+            }
+            if (length > WRITE_CHUNK - used) {
+                length = WRITE_CHUNK - used;
+            }
+            memcpy(out + used, ring->data + offset, length);
+            used += length;
+            tail += length;
+            if (used == WRITE_CHUNK) {
+                write_all(out, used);
+                used = 0;
+            }
+        }
+        if (atomic_load_explicit(&ring->tail, memory_order_relaxed) != tail) {
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+            drained = 1;
+        }
+        // Its records are copied to out already
+        if (retired && unlink_ring(prev, ring)) {
+            free(ring);
+            continue;
+        }
+        prev = ring;
+    }
+    write_all(out, used);
+    return drained;
+}
+
+static void *writer_thread(void *args)
+{
+    (void)args;
+    char *out = (char *)malloc(WRITE_CHUNK);
+    if (out == NULL) {
+        perror("Error allocating log buffer");
+        exit(EXIT_FAILURE);
+    }
+    while (1) {
+        if (drain(out)) {
+            continue;
+        }
+        if (!atomic_load(&running)) {
+            // Stopping and nothing left, a last pass catches records published while we checked
+            drain(out);
+            break;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += IDLE_WAIT_NS;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&wake_mutex);
+        pthread_cond_timedwait(&wake_cond, &wake_mutex, &until);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+    free(out);
+    return NULL;
+}
+
+void async_log_start(int fd, LogLevel default_level)
+{
+    const char *names[] = {"error", "info", "debug"};
+    int level = default_level;
+    const char *requested = getenv("LOG_LEVEL");
+    for (int i = 0; requested != NULL && i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcasecmp(requested, names[i]) == 0) {
+            level = i;
+        }
+    }
+    atomic_store(&async_log_level, level);
+
+    out_fd = fd;
+    atomic_store_explicit(&running, 1, memory_order_release);
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+        perror("Error creating log writer thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Every logging thread must be done logging, or be joined, before the logger stops
+void async_log_stop(void)
+{
+    if (!atomic_load(&running)) {
+        return;
+    }
+    atomic_store(&running, 0);
+    wake_writer();
+    pthread_join(writer, NULL);
+    // Exiting threads stop retiring the rings freed here
+    atomic_fetch_add(&generation, 1);
+
+    LogRing *ring = atomic_exchange(&rings, NULL);
+    while (ring != NULL) {
+        LogRing *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+}
@@ -0,0 +1,41 @@
+// async_log.h
+// Asynchronous logger for the C pipelines. Each thread formats into its own lock-free ring, and one writer
+// thread drains every ring into large write(2) calls, so logging threads never share a lock.
+// The level is checked before the arguments are evaluated, so a disabled message costs one relaxed load.
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG     // Per-message trace
+} LogLevel;
+
+// Messages above this level are skipped, it can be changed while the program runs
+extern atomic_int async_log_level;
+
+// Start the writer thread writing to fd. The level is read from the LOG_LEVEL environment variable
+// ("error", "info" or "debug"), default_level is used when it is not set.
+void async_log_start(int fd, LogLevel default_level);
+// Write out everything logged so far and stop the writer thread
+void async_log_stop(void);
+void async_log_write(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+#define ASYNC_LOG(level, ...) \
+    do { \
+        if ((int)(level) <= atomic_load_explicit(&async_log_level, memory_order_relaxed)) { \
+            async_log_write(__VA_ARGS__); \
+        } \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,142 @@
+#include "batch_classifier.h"
+#include "fast_random.h"
+#include "routing.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const char* const kernels[] = { "scalar", "sse2", "avx2" };
+
+// Classify messages in batches with every kernel this CPU has and count the masks that differ from route
+static int mismatches(const RoutingTable& routing, const std::vector<std::string>& messages)
+{
+    int wrong = 0;
+    for (const char* kernel : kernels) {
+        if (!BatchClassifier::hasKernel(kernel)) {
+            continue;
+        }
+        BatchClassifier classifier(routing, kernel);
+        RoutingTable::Mask masks[BatchClassifier::MAX_BATCH];
+        for (size_t first = 0; first < messages.size(); first += BatchClassifier::MAX_BATCH) {
+            size_t count = std::min<size_t>(BatchClassifier::MAX_BATCH, messages.size() - first);
+            classifier.classify(messages.data() + first, count, masks);
+            for (size_t i = 0; i < count; ++i) {
+                RoutingTable::Mask expected = routing.route(messages[first + i]);
+                if (masks[i] != expected) {
+                    if (wrong++ == 0) {
+                        printf("\033[0;31m%s: \"%s\" got %llx, route gives %llx\n\033[0m", kernel,
+                               messages[first + i].c_str(), (unsigned long long)masks[i],
+                               (unsigned long long)expected);
+                    }
+                }
+            }
+        }
+    }
+    return wrong;
+}
+
+// Edge cases every table is checked with: long messages, long tokens and missing or doubled spaces
+static std::vector<std::string> edgeMessages()
+{
+    std::vector<std::string> messages = {
+        "Producer 1 SPORTS 0", "Producer 22 NEWS 5", "Producer 3 WEATHER 17", "Producer 4 UNKNOWN 1",
+        "Producer 5 BREAKING 2", "Producer 6 BREAKINGNEWS 3", "Producer 7 BREAKIN 4", "Producer 8 NEWSX 5",
+        "Producer 9 NEWS", "Producer 9 NEWS ", "Producer 9 ", "Producer 9", "Producer9 NEWS 1",
+        "Producer 9NEWS 1", "ProducerNEWS", "Producer  NEWS 1", "Producer 9  NEWS 1", " 9 NEWS 1", "NEWS",
+        "", " ", "  ", "Producer -4 SPORTS 2", "Producer 1 SPORTS 0 trailing words and more",
+    };
+    // Around the 64 byte row: the category inside the row, and messages that end on or past its edge
+    for (size_t length = 60; length <= 70; ++length) {
+        std::string message = "Producer 10 NEWS ";
+        message.append(length - message.size(), '7');
+        messages.push_back(message);
+    }
+    std::string longId = "Producer " + std::string(59, '0') + "1 SPORTS 3";
+    messages.push_back(longId);
+    messages.push_back("Producer 1 " + std::string(70, 'A') + " 2");
+
+    // Random short messages mixing category tokens, spaces and digits, so rows keep bytes of longer ones
+    static const char* const pieces[] = { "Producer", "SPORTS", "NEWS", "WEATHER", "BREAKING", "BREAKINGNEWS",
+                                          "1", "42", " ", "  ", "X" };
+    Xoshiro256 rander(7);
+    for (int i = 0; i < 20000; ++i) {
+        std::string message;
+        int parts = static_cast<int>(rander.below(8));
+        for (int part = 0; part < parts; ++part) {
+            message += pieces[rander.below(sizeof(pieces) / sizeof(pieces[0]))];
+        }
+        messages.push_back(message);
+    }
+    return messages;
+}
+
+int test1(){
+    // ============================= TEST 1: Category rules use the fast path =============================
+    RoutingTable routing(RoutingTable::byCategory({ "SPORTS", "NEWS", "WEATHER", "BREAKING" }));
+    int wrong = routing.categoryOnly() ? mismatches(routing, edgeMessages()) : -1;
+    if (wrong == 0) {
+        printf("\033[0;32mTEST 1: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 1: FAILED\n\033[0m");
+        printf("\033[0;31m%d masks differ from RoutingTable::route\n\033[0m", wrong);
+        return -1;
+    }
+    // ============================= END OF TEST 1: Category rules use the fast path ======================
+}
+
+int test2(){
+    // ============================= TEST 2: Category tokens longer than 8 bytes ==========================
+    RoutingTable routing(RoutingTable::byCategory({ "SPORTS", "BREAKINGNEWS", "NEWS" }));
+    int wrong = mismatches(routing, edgeMessages());
+    if (wrong == 0) {
+        printf("\033[0;32mTEST 2: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 2: FAILED\n\033[0m");
+        printf("\033[0;31m%d masks differ from RoutingTable::route\n\033[0m", wrong);
+        return -1;
+    }
+    // ============================= END OF TEST 2: Category tokens longer than 8 bytes ===================
+}
+
+int test3(){
+    // ============================= TEST 3: Producer and substring rules next to category rules =========
+    std::vector<RouteRule> rules = RoutingTable::byCategory({ "SPORTS", "NEWS", "WEATHER" });
+    rules.push_back({ RouteRule::Producer, "", 1, { 3 } });
+    rules.push_back({ RouteRule::Producer, "", -4, { 4 } });
+    rules.push_back({ RouteRule::Contains, "AKING", 0, { 5 } });
+    rules.push_back({ RouteRule::Contains, " 7", 0, { 1, 6 } });
+    RoutingTable routing(rules);
+    int wrong = mismatches(routing, edgeMessages());
+    if (wrong == 0) {
+        printf("\033[0;32mTEST 3: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 3: FAILED\n\033[0m");
+        printf("\033[0;31m%d masks differ from RoutingTable::route\n\033[0m", wrong);
+        return -1;
+    }
+    // ============================= END OF TEST 3: Producer and substring rules next to category rules ==
+}
+
+
+int main() {
+    int countTestPassed = 0;
+    if (test1() == 0){
+        countTestPassed++;
+    }
+    if (test2() == 0){
+        countTestPassed++;
+    }
+    if (test3() == 0){
+        countTestPassed++;
+    }
+    if (countTestPassed == 3){
+        printf("\033[0;32mAll tests passed!\n\033[0m");
+    } else {
+        printf("\033[0;31mSome tests failed\n\033[0m");
+    }
+    return 0;
+}
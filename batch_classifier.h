@@ -0,0 +1,259 @@
+#ifndef BATCH_CLASSIFIER_H
+#define BATCH_CLASSIFIER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_CLASSIFIER_X86 1
+#endif
+
+#include "routing.h"
+
+// Routes a batch of messages at once.
+//
+// Messages are copied into fixed ROW byte rows of one aligned block, and a SIMD kernel turns every row into
+// a bitmap of its spaces. The category token is found from the bitmap ("Producer <id> <CATEGORY> <n>"),
+// loaded as one 64-bit word and compared with the category tokens of the routing table. The kernel is
+// picked at startup: AVX2 when the CPU has it, SSE2 on any other x86-64, portable word-at-a-time code elsewhere.
+// Messages longer than a row, categories longer than 8 bytes and tables with producer or substring rules
+// fall back to RoutingTable::route.
+class BatchClassifier
+{
+public:
+    enum { ROW = 64, MAX_BATCH = 64 };
+
+    explicit BatchClassifier(const RoutingTable& routing) : routing(routing), fast(routing.categoryOnly())
+    {
+        for (const RoutingTable::Token& token : routing.categoryTokens())
+        {
+            if (token.text.empty() || token.text.size() > 8)
+            {
+                fast = false;
+                break;
+            }
+            keys.push_back({ load(token.text.data(), token.text.size()), token.mask });
+        }
+
+        // One spare row so 8 byte loads near the end of the last row stay inside the block
+        block = static_cast<char*>(aligned_alloc(ROW, (MAX_BATCH + 1) * ROW));
+        if (!block)
+        {
+            throw std::bad_alloc();
+        }
+        memset(block, 0, (MAX_BATCH + 1) * ROW);
+        spaces = pickKernel();
+    }
+
+    // Use the named kernel ("avx2", "sse2" or "scalar") instead of the fastest one, to compare them
+    BatchClassifier(const RoutingTable& routing, const char* kernel) : BatchClassifier(routing)
+    {
+        spaces = namedKernel(kernel);
+        if (!spaces)
+        {
+            throw std::invalid_argument(std::string("no ") + kernel + " kernel on this CPU");
+        }
+    }
+
+    ~BatchClassifier()
+    {
+        free(block);
+    }
+
+    BatchClassifier(const BatchClassifier&) = delete;
+    BatchClassifier& operator=(const BatchClassifier&) = delete;
+
+    // Name of the kernel chosen for this CPU
+    static const char* kernelName()
+    {
+        SpaceKernel kernel = pickKernel();
+#ifdef BATCH_CLASSIFIER_X86
+        if (kernel == spacesAvx2)
+        {
+            return "avx2";
+        }
+        if (kernel == spacesSse2)
+        {
+            return "sse2";
+        }
+#endif
+        return kernel == spacesScalar ? "scalar" : "unknown";
+    }
+
+    // Whether this CPU can run the named kernel
+    static bool hasKernel(const char* name)
+    {
+        return namedKernel(name) != nullptr;
+    }
+
+    // Write the output mask of each of count (at most MAX_BATCH) messages to masks
+    void classify(const std::string* messages, size_t count, RoutingTable::Mask* masks)
+    {
+        if (!fast)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                masks[i] = routing.route(messages[i]);
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (messages[i].size() < ROW)
+            {
+                memcpy(block + i * ROW, messages[i].data(), messages[i].size());
+            }
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t length = messages[i].size();
+            if (length >= ROW)
+            {
+                masks[i] = routing.route(messages[i]);
+                continue;
+            }
+            const char* row = block + i * ROW;
+            masks[i] = lookup(row, spaces(row) & ((uint64_t(1) << length) - 1), length);
+        }
+    }
+
+private:
+    using SpaceKernel = uint64_t (*)(const char* row);
+
+    struct Key
+    {
+        uint64_t word;
+        RoutingTable::Mask mask;
+    };
+
+    static uint64_t load(const char* text, size_t length)
+    {
+        uint64_t word = 0;
+        memcpy(&word, text, length);
+        return word;
+    }
+
+    // Find the category token from the space bitmap of a row and look it up
+    RoutingTable::Mask lookup(const char* row, uint64_t bitmap, size_t length) const
+    {
+        // Drop the spaces after "Producer" and after the id, the token starts after the second one
+        if (bitmap == 0 || (bitmap &= bitmap - 1) == 0)
+        {
+            return 0;
+        }
+        size_t start = __builtin_ctzll(bitmap) + 1;
+        bitmap &= bitmap - 1;
+        size_t end = bitmap ? __builtin_ctzll(bitmap) : length;
+        size_t size = end - start;
+        if (size == 0 || size > 8)
+        {
+            return 0;
+        }
+
+        uint64_t word;
+        memcpy(&word, row + start, 8);
+        word &= size == 8 ? ~uint64_t(0) : (uint64_t(1) << (size * 8)) - 1;
+        for (const Key& key : keys)
+        {
+            if (key.word == word)
+            {
+                return key.mask;
+            }
+        }
+        return 0;
+    }
+
+    // Portable fallback, eight bytes per step: the high bit of every byte equal to ' ' is set exactly,
+    // then the eight high bits are gathered into one byte by a multiply
+    static uint64_t spacesScalar(const char* row)
+    {
+        const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+        uint64_t bitmap = 0;
+        for (int i = 0; i < ROW; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, row + i, 8);
+            uint64_t x = word ^ 0x2020202020202020ULL;
+            uint64_t zero = ~(((x & low7) + low7) | x | low7);
+            bitmap |= (((zero >> 7) * 0x0102040810204080ULL) >> 56) << i;
+        }
+        return bitmap;
+    }
+
+#ifdef BATCH_CLASSIFIER_X86
+    __attribute__((target("sse2")))
+    static uint64_t spacesSse2(const char* row)
+    {
+        const __m128i space = _mm_set1_epi8(' ');
+        uint64_t bitmap = 0;
+        for (int i = 0; i < ROW; i += 16)
+        {
+            __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(row + i));
+            bitmap |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)))) << i;
+        }
+        return bitmap;
+    }
+
+    __attribute__((target("avx2")))
+    static uint64_t spacesAvx2(const char* row)
+    {
+        const __m256i space = _mm256_set1_epi8(' ');
+        __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i*>(row));
+        __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i*>(row + 32));
+        uint64_t lowBits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, space)));
+        uint64_t highBits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, space)));
+        return lowBits | (highBits << 32);
+    }
+#endif
+
+    static SpaceKernel pickKernel()
+    {
+#ifdef BATCH_CLASSIFIER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return spacesAvx2;
+        }
+        if (__builtin_cpu_supports("sse2"))
+        {
+            return spacesSse2;
+        }
+#endif
+        return spacesScalar;
+    }
+
+    static SpaceKernel namedKernel(const char* name)
+    {
+        if (strcmp(name, "scalar") == 0)
+        {
+            return spacesScalar;
+        }
+#ifdef BATCH_CLASSIFIER_X86
+        __builtin_cpu_init();
+        if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        {
+            return spacesSse2;
+        }
+        if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        {
+            return spacesAvx2;
+        }
+#endif
+        return nullptr;
+    }
+
+    const RoutingTable& routing;
+    bool fast;
+    std::vector<Key> keys;
+    char* block;
+    SpaceKernel spaces;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "bounded_buffer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// 128 bytes: two records of the largest size kept in the ring, 64 bytes each
+#define RING_BYTES 128
+
+// Remove the oldest string and compare it with expected, return 0 if it matches
+static int expect_next(BoundedBuffer *bb, const char *expected)
+{
+    char *str = try_remove_bounded_buffer(bb);
+    int matches = str != NULL && strcmp(str, expected) == 0;
+    if (!matches) {
+        printf("\033[0;32mExpected output: %s \n\033[0m", expected);
+        printf("\033[0;31mActual output: %s \n\033[0m", str != NULL ? str : "(empty buffer)");
+    }
+    free(str);
+    return matches ? 0 : -1;
+}
+
+int test1(){
+    // ============================== TEST 1: A record that would wrap goes after a pad record ===========
+    // Each 39 character string takes a 48 byte record. The third one starts 96 bytes in, where only 32
+    // are left: the end of the ring is padded and the record starts over at the beginning.
+    char first[40], second[40], third[40];
+    memset(first, 'a', 39);
+    memset(second, 'b', 39);
+    memset(third, 'c', 39);
+    first[39] = second[39] = third[39] = '\0';
+
+    BoundedBuffer *bb = create_bounded_buffer_bytes(RING_BYTES, 0);
+    int passed = insert_bounded_buffer(bb, first) == 0 && insert_bounded_buffer(bb, second) == 0;
+    const char *ringStart = try_peek_bounded_buffer(bb);
+    passed = passed && expect_next(bb, first) == 0;
+    passed = passed && insert_bounded_buffer(bb, third) == 0;
+    passed = passed && bounded_buffer_count(bb) == 2;
+    passed = passed && expect_next(bb, second) == 0;
+    // The pad is skipped and the third string is read from the start of the ring
+    const char *wrapped = try_peek_bounded_buffer(bb);
+    passed = passed && wrapped == ringStart;
+    passed = passed && expect_next(bb, third) == 0;
+    passed = passed && try_peek_bounded_buffer(bb) == NULL && bounded_buffer_count(bb) == 0;
+    // The ring goes on after the wrap
+    passed = passed && insert_bounded_buffer(bb, first) == 0 && expect_next(bb, first) == 0;
+    destroy_bounded_buffer(bb);
+
+    if (passed) {
+        printf("\033[0;32mTEST 1: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 1: FAILED\n\033[0m");
+        printf("\033[0;31mThird record at %s\n\033[0m", wrapped == ringStart ? "the ring start" : "the wrong place");
+        return -1;
+    }
+    // ============================== END OF TEST 1: A record that would wrap goes after a pad record ====
+}
+
+int test2(){
+    // ============================== TEST 2: Strings over half the ring go through the heap =============
+    // A 1000 byte string would not fit the ring at all; its record only holds a pointer, so eight of them
+    // fill the 128 bytes without blocking, and they come out in order between the ring records.
+    enum { BIG = 1000, BIG_COUNT = RING_BYTES / 16 };
+    char *big[BIG_COUNT];
+    for (int i = 0; i < BIG_COUNT; i++) {
+        big[i] = (char *)malloc(BIG + 1);
+        memset(big[i], 'A' + i, BIG);
+        big[i][BIG] = '\0';
+    }
+
+    BoundedBuffer *bb = create_bounded_buffer_bytes(RING_BYTES, 0);
+    int passed = 1;
+    for (int i = 0; i < BIG_COUNT; i++) {
+        passed = passed && insert_bounded_buffer(bb, big[i]) == 0;
+    }
+    passed = passed && bounded_buffer_count(bb) == BIG_COUNT;
+    size_t length = 0;
+    passed = passed && try_peek_bounded_buffer_record(bb, &length) != NULL && length == BIG;
+    for (int i = 0; i < BIG_COUNT; i++) {
+        passed = passed && expect_next(bb, big[i]) == 0;
+    }
+
+    // Heap records mixed with ring records keep their order
+    passed = passed && insert_bounded_buffer(bb, "small 1") == 0 && insert_bounded_buffer(bb, big[0]) == 0 &&
+             insert_bounded_buffer(bb, "small 2") == 0 && insert_bounded_buffer(bb, big[1]) == 0;
+    passed = passed && expect_next(bb, "small 1") == 0 && expect_next(bb, big[0]) == 0 &&
+             expect_next(bb, "small 2") == 0 && expect_next(bb, big[1]) == 0;
+    passed = passed && bounded_buffer_count(bb) == 0;
+    destroy_bounded_buffer(bb);
+    for (int i = 0; i < BIG_COUNT; i++) {
+        free(big[i]);
+    }
+
+    if (passed) {
+        printf("\033[0;32mTEST 2: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 2: FAILED\n\033[0m");
+        return -1;
+    }
+    // ============================== END OF TEST 2: Strings over half the ring go through the heap ======
+}
+
+int test3(){
+    // ============================== TEST 3: Commit gives unused reserved bytes back ====================
+    // A 56 byte reservation takes a 64 byte record. A single producer buffer shrinks it to the 16 bytes a
+    // short string needs, so the next reservation starts right after; other buffers keep the whole record.
+    const char *strings[] = { "m0", "m1" };
+    size_t steps[2] = { 0, 0 };
+    int flags[2] = { BOUNDED_BUFFER_SINGLE_PRODUCER, 0 };
+    int passed = 1;
+    for (int b = 0; b < 2; b++) {
+        BoundedBuffer *bb = create_bounded_buffer_bytes(RING_BYTES, flags[b]);
+        char *previous = NULL;
+        // Two records, so even the full 64 byte ones fit without blocking
+        for (int i = 0; i < 2; i++) {
+            char *slot = reserve_bounded_buffer_length(bb, 56);
+            if (slot == NULL) {
+                perror("reserve_bounded_buffer_length 3");
+                destroy_bounded_buffer(bb);
+                return 1;
+            }
+            if (previous != NULL) {
+                steps[b] = (size_t)(slot - previous);
+            }
+            previous = slot;
+            strcpy(slot, strings[i]);
+            commit_bounded_buffer(bb);
+        }
+        passed = passed && expect_next(bb, strings[0]) == 0 && expect_next(bb, strings[1]) == 0;
+        destroy_bounded_buffer(bb);
+    }
+    passed = passed && steps[0] == 16 && steps[1] == 64;
+
+    // The bytes given back are reused, and the shrunk records wrap through pad records like any other
+    BoundedBuffer *bb = create_bounded_buffer_bytes(RING_BYTES, BOUNDED_BUFFER_SINGLE_PRODUCER);
+    for (int round = 0; round < 100 && passed; round++) {
+        for (int i = 0; i < 2; i++) {
+            char *slot = reserve_bounded_buffer_length(bb, 56);
+            passed = passed && slot != NULL;
+            if (slot != NULL) {
+                strcpy(slot, strings[i]);
+                commit_bounded_buffer(bb);
+            }
+        }
+        for (int i = 0; i < 2; i++) {
+            passed = passed && expect_next(bb, strings[i]) == 0;
+        }
+    }
+    destroy_bounded_buffer(bb);
+
+    if (passed) {
+        printf("\033[0;32mTEST 3: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 3: FAILED\n\033[0m");
+        printf("\033[0;31mReservations %zu bytes apart with a single producer, %zu without\n\033[0m", steps[0], steps[1]);
+        return -1;
+    }
+    // ============================== END OF TEST 3: Commit gives unused reserved bytes back =============
+}
+
+
+int main() {
+    int countTestPassed = 0;
+    if (test1() == 0){
+        countTestPassed++;
+    }
+    if (test2() == 0){
+        countTestPassed++;
+    }
+    if (test3() == 0){
+        countTestPassed++;
+    }
+    if (countTestPassed == 3){
+        printf("\033[0;32mAll tests passed!\n\033[0m");
+    } else {
+        printf("\033[0;31mSome tests failed\n\033[0m");
+    }
+    return 0;
+}
@@ -0,0 +1,464 @@
+#define _GNU_SOURCE
+#include "bounded_buffer.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define CACHE_LINE 64
+#define RECORD_ALIGN 8
+#define HEADER_SIZE 8
+#define PAD_FLAG 0x80000000u    // Set in the size of the record that fills the unused end of the ring
+#define HEAP_FLAG 0x40000000u   // Set in the size of a record whose payload is a pointer to a heap copy of the string
+#define SPIN_LIMIT 128          // Checks before a waiting thread sleeps on the futex
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+// Records are a header, then the null terminated payload, padded to RECORD_ALIGN. Records never wrap:
+// a pad record fills the end of the ring when the next one does not fit there. A string longer than
+// half the ring is kept in its own allocation, its record only holds the pointer.
+//
+// Free bytes of the ring are always zero, the consumer clears every record it releases. A record is
+// published by the release store of its nonzero size, so the consumer reads the header at tail and
+// needs no shared producer index; a size of 0 means the next record is not committed yet.
+typedef struct {
+    atomic_uint size;           // Record bytes, header included, or 0 while uncommitted
+    uint32_t length;            // Payload bytes including the terminating null
+} RecordHeader;
+
+// Ring bytes of a record pointing to a heap copy
+#define HEAP_RECORD_SIZE (HEADER_SIZE + sizeof(char *))
+
+struct BufferSignal {
+    atomic_uint sequence;           // The futex word
+    atomic_uint waiters;            // Sleeping threads, notifiers skip the wake syscall while it is 0
+};
+
+struct BoundedBuffer {
+    char *data;                     // capacity bytes, one cache aligned allocation
+    size_t capacity;
+    int single_producer;
+    BufferSignal *signal;           // Bumped on every commit, may be NULL
+    // Producers and the consumer each write their own cache line
+    _Alignas(CACHE_LINE) atomic_size_t head;    // End of the reserved bytes, only ever grows
+    BufferSignal has_space;                     // Producers waiting for the consumer
+    _Alignas(CACHE_LINE) atomic_size_t tail;    // Start of the oldest record, written by the consumer only
+    BufferSignal has_data;                      // The consumer waiting for producers
+    _Alignas(CACHE_LINE) atomic_int count;      // Committed and not yet released
+};
+
+// The one reservation a thread may hold between reserve and commit
+static _Thread_local struct {
+    size_t position;
+    size_t length;
+    char *heap;                 // Heap copy the producer writes into for an oversized string, or NULL
+} reservation;
+
+static void fail(const char *what)
+{
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static long futex(atomic_uint *word, int op, unsigned value)
+{
+    return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
+
+static void notify_buffer_signal(BufferSignal *signal)
+{
+    // Both sides use sequentially consistent operations: either the sleeper sees the new sequence
+    // before it sleeps, or this sees the sleeper and wakes it
+    atomic_fetch_add(&signal->sequence, 1);
+    if (atomic_load(&signal->waiters) != 0) {
+        futex(&signal->sequence, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+}
+
+// Wake the threads sleeping on a ring's own signal after publishing a change. Unlike
+// notify_buffer_signal the sequence only moves when someone sleeps, so an uncontended insert or
+// remove makes no read-modify-write here. The fence orders the published change before the
+// waiters check, and a sleeper registers before it rechecks the ring.
+static void wake_waiters(BufferSignal *signal)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&signal->waiters, memory_order_relaxed) != 0) {
+        atomic_fetch_add(&signal->sequence, 1);
+        futex(&signal->sequence, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+}
+
+// One step of waiting for a ring condition that was just found false: spin for a while, then
+// register as a waiter and recheck once, then sleep until wake_waiters. spins and seen start at 0
+// and are kept across steps; call end_wait once the condition holds.
+static void wait_step(BufferSignal *signal, int *spins, unsigned *seen)
+{
+    if (*spins < SPIN_LIMIT) {
+        (*spins)++;
+        cpu_relax();
+        return;
+    }
+    if (*spins == SPIN_LIMIT) {
+        (*spins)++;
+        atomic_fetch_add(&signal->waiters, 1);
+        // Pairs with the fence in wake_waiters: either the caller's recheck of the ring sees the
+        // notifier's change, or the notifier sees this waiter. Only paid on the way to sleeping.
+        atomic_thread_fence(memory_order_seq_cst);
+        *seen = atomic_load(&signal->sequence);
+        return;
+    }
+    if (futex(&signal->sequence, FUTEX_WAIT_PRIVATE, *seen) == -1 && errno != EAGAIN && errno != EINTR) {
+        fail("Error waiting on BoundedBuffer");
+    }
+    *seen = atomic_load(&signal->sequence);
+}
+
+static void end_wait(BufferSignal *signal, int spins)
+{
+    if (spins > SPIN_LIMIT) {
+        atomic_fetch_sub(&signal->waiters, 1);
+    }
+}
+
+BufferSignal *create_buffer_signal(void)
+{
+    BufferSignal *signal = (BufferSignal *)malloc(sizeof(BufferSignal));
+    if (signal == NULL) {
+        fail("Error allocating BufferSignal");
+    }
+    atomic_init(&signal->sequence, 0);
+    atomic_init(&signal->waiters, 0);
+    return signal;
+}
+
+void destroy_buffer_signal(BufferSignal *signal)
+{
+    free(signal);
+}
+
+void attach_buffer_signal(BoundedBuffer *bb, BufferSignal *signal)
+{
+    bb->signal = signal;
+}
+
+unsigned read_buffer_signal(BufferSignal *signal)
+{
+    return atomic_load(&signal->sequence);
+}
+
+unsigned wait_buffer_signal(BufferSignal *signal, unsigned seen)
+{
+    atomic_fetch_add(&signal->waiters, 1);
+    unsigned current;
+    while ((current = atomic_load(&signal->sequence)) == seen) {
+        // The kernel rechecks the word, so a commit between the load and the sleep is not lost
+        if (futex(&signal->sequence, FUTEX_WAIT_PRIVATE, seen) == -1 && errno != EAGAIN && errno != EINTR) {
+            fail("Error waiting on buffer signal");
+        }
+    }
+    atomic_fetch_sub(&signal->waiters, 1);
+    return current;
+}
+
+int bounded_buffer_count(BoundedBuffer *bb)
+{
+    return atomic_load_explicit(&bb->count, memory_order_relaxed);
+}
+
+static size_t record_size(size_t length)
+{
+    return HEADER_SIZE + (length + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+
+static RecordHeader *header_at(BoundedBuffer *bb, size_t position)
+{
+    return (RecordHeader *)(bb->data + position % bb->capacity);
+}
+
+BoundedBuffer *create_bounded_buffer_bytes(size_t capacity, int flags)
+{
+    capacity = (capacity + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    if (capacity == 0) {
+        fprintf(stderr, "Error: BoundedBuffer capacity must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    void *memory;
+    int error = posix_memalign(&memory, CACHE_LINE, sizeof(BoundedBuffer));
+    if (error != 0) {
+        errno = error;
+        fail("Error allocating BoundedBuffer");
+    }
+    BoundedBuffer *bb = (BoundedBuffer *)memory;
+
+    error = posix_memalign(&memory, CACHE_LINE, capacity);
+    if (error != 0) {
+        errno = error;
+        fail("Error allocating buffer in BoundedBuffer");
+    }
+    bb->data = (char *)memory;
+    memset(bb->data, 0, capacity);
+
+    bb->capacity = capacity;
+    bb->single_producer = (flags & BOUNDED_BUFFER_SINGLE_PRODUCER) != 0;
+    bb->signal = NULL;
+    atomic_init(&bb->head, 0);
+    atomic_init(&bb->tail, 0);
+    atomic_init(&bb->count, 0);
+    atomic_init(&bb->has_space.sequence, 0);
+    atomic_init(&bb->has_space.waiters, 0);
+    atomic_init(&bb->has_data.sequence, 0);
+    atomic_init(&bb->has_data.waiters, 0);
+
+    return bb;
+}
+
+static BoundedBuffer *create_sized(int size, int flags)
+{
+    if (size <= 0) {
+        fprintf(stderr, "Error: BoundedBuffer size must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    // At least two full strings, a record may take at most half of the ring
+    size_t capacity = (size_t)(size > 2 ? size : 2) * record_size(BOUNDED_BUFFER_MAX_STRING);
+    return create_bounded_buffer_bytes(capacity, flags);
+}
+
+BoundedBuffer *create_bounded_buffer(int size)
+{
+    return create_sized(size, 0);
+}
+
+BoundedBuffer *create_single_producer_bounded_buffer(int size)
+{
+    return create_sized(size, BOUNDED_BUFFER_SINGLE_PRODUCER);
+}
+
+char *reserve_bounded_buffer_length(BoundedBuffer *bb, size_t length)
+{
+    if (length == 0 || length > UINT32_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    // With records of at most half the ring, a record and the pad before it always fit an empty ring.
+    // A longer string goes to the heap and takes a pointer record in the ring.
+    char *heap = NULL;
+    size_t size = record_size(length);
+    if (size > bb->capacity / 2) {
+        heap = (char *)malloc(length);
+        if (heap == NULL) {
+            return NULL;
+        }
+        size = HEAP_RECORD_SIZE;
+    }
+
+    int spins = 0;
+    unsigned seen = 0;
+    size_t head, to_end;
+    while (1) {
+        head = atomic_load_explicit(&bb->head, memory_order_relaxed);
+        to_end = bb->capacity - head % bb->capacity;
+        size_t needed = size <= to_end ? size : to_end + size;
+        if (bb->capacity - (head - atomic_load_explicit(&bb->tail, memory_order_acquire)) < needed) {
+            wait_step(&bb->has_space, &spins, &seen);
+            continue;
+        }
+        if (bb->single_producer) {
+            atomic_store_explicit(&bb->head, head + needed, memory_order_relaxed);
+            break;
+        }
+        // Producers claim their bytes by moving head, the loser retries from the new head
+        if (atomic_compare_exchange_weak_explicit(&bb->head, &head, head + needed, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            break;
+        }
+    }
+    end_wait(&bb->has_space, spins);
+
+    size_t position = head;
+    if (size > to_end) {
+        atomic_store_explicit(&header_at(bb, position)->size, (uint32_t)to_end | PAD_FLAG, memory_order_release);
+        position += to_end;
+    }
+    reservation.position = position;
+    reservation.length = length;
+    reservation.heap = heap;
+    return heap != NULL ? heap : bb->data + position % bb->capacity + HEADER_SIZE;
+}
+
+char *reserve_bounded_buffer(BoundedBuffer *bb)
+{
+    return reserve_bounded_buffer_length(bb, BOUNDED_BUFFER_MAX_STRING);
+}
+
+void commit_bounded_buffer(BoundedBuffer *bb)
+{
+    RecordHeader *header = header_at(bb, reservation.position);
+    char *payload = reservation.heap != NULL ? reservation.heap : (char *)header + HEADER_SIZE;
+    // Never let a producer that overran its reservation leave an unterminated string behind
+    payload[reservation.length - 1] = '\0';
+    size_t length = strlen(payload) + 1;
+
+    if (reservation.heap != NULL) {
+        memcpy((char *)header + HEADER_SIZE, &reservation.heap, sizeof(char *));
+        header->length = (uint32_t)length;
+        atomic_fetch_add_explicit(&bb->count, 1, memory_order_relaxed);
+        atomic_store_explicit(&header->size, (uint32_t)HEAP_RECORD_SIZE | HEAP_FLAG, memory_order_release);
+        reservation.heap = NULL;
+        wake_waiters(&bb->has_data);
+        if (bb->signal != NULL) {
+            notify_buffer_signal(bb->signal);
+        }
+        return;
+    }
+
+    size_t size = record_size(reservation.length);
+    if (bb->single_producer) {
+        // Nobody reserved after us: give the unused end of the reservation back, cleared like all free bytes
+        size_t used = record_size(length);
+        memset((char *)header + used, 0, size - used);
+        atomic_store_explicit(&bb->head, reservation.position + used, memory_order_relaxed);
+        size = used;
+    }
+
+    header->length = (uint32_t)length;
+    atomic_fetch_add_explicit(&bb->count, 1, memory_order_relaxed);
+    atomic_store_explicit(&header->size, (uint32_t)size, memory_order_release);
+    wake_waiters(&bb->has_data);
+    if (bb->signal != NULL) {
+        notify_buffer_signal(bb->signal);
+    }
+}
+
+// Clear a consumed record and hand its bytes back to the producers
+static void free_record(BoundedBuffer *bb, size_t tail, size_t size)
+{
+    RecordHeader *header = header_at(bb, tail);
+    atomic_store_explicit(&header->size, 0, memory_order_relaxed);
+    memset((char *)header + sizeof(header->size), 0, size - sizeof(header->size));
+    atomic_store_explicit(&bb->tail, tail + size, memory_order_release);
+    wake_waiters(&bb->has_space);
+}
+
+// Skip a padded ring end and return the oldest committed record, or NULL if there is none
+static const char *oldest_record(BoundedBuffer *bb, size_t *length)
+{
+    size_t tail = atomic_load_explicit(&bb->tail, memory_order_relaxed);
+    RecordHeader *header = header_at(bb, tail);
+    uint32_t size = atomic_load_explicit(&header->size, memory_order_acquire);
+    if (size & PAD_FLAG) {
+        free_record(bb, tail, size & ~PAD_FLAG);
+        header = header_at(bb, tail + (size & ~PAD_FLAG));
+        size = atomic_load_explicit(&header->size, memory_order_acquire);
+    }
+    if (size == 0) {
+        return NULL;
+    }
+    if (length != NULL) {
+        *length = header->length - 1;
+    }
+    if (size & HEAP_FLAG) {
+        char *heap;
+        memcpy(&heap, (char *)header + HEADER_SIZE, sizeof(char *));
+        return heap;
+    }
+    return (const char *)header + HEADER_SIZE;
+}
+
+const char *peek_bounded_buffer_record(BoundedBuffer *bb, size_t *length)
+{
+    int spins = 0;
+    unsigned seen = 0;
+    const char *record;
+    while ((record = oldest_record(bb, length)) == NULL) {
+        wait_step(&bb->has_data, &spins, &seen);
+    }
+    end_wait(&bb->has_data, spins);
+    return record;
+}
+
+const char *peek_bounded_buffer(BoundedBuffer *bb)
+{
+    return peek_bounded_buffer_record(bb, NULL);
+}
+
+const char *try_peek_bounded_buffer_record(BoundedBuffer *bb, size_t *length)
+{
+    return oldest_record(bb, length);
+}
+
+const char *try_peek_bounded_buffer(BoundedBuffer *bb)
+{
+    return oldest_record(bb, NULL);
+}
+
+void release_bounded_buffer(BoundedBuffer *bb)
+{
+    size_t tail = atomic_load_explicit(&bb->tail, memory_order_relaxed);
+    RecordHeader *header = header_at(bb, tail);
+    uint32_t size = atomic_load_explicit(&header->size, memory_order_relaxed);
+    if (size & HEAP_FLAG) {
+        char *heap;
+        memcpy(&heap, (char *)header + HEADER_SIZE, sizeof(char *));
+        free(heap);
+    }
+    // Counted here rather than at peek, so peeking the same record again leaves the count alone
+    atomic_fetch_sub_explicit(&bb->count, 1, memory_order_relaxed);
+    free_record(bb, tail, size & ~HEAP_FLAG);
+}
+
+int insert_bounded_buffer(BoundedBuffer *bb, const char *str)
+{
+    size_t length = strlen(str) + 1;
+    char *slot = reserve_bounded_buffer_length(bb, length);
+    if (slot == NULL) {
+        return -1;
+    }
+    memcpy(slot, str, length);
+    commit_bounded_buffer(bb);
+    return 0;
+}
+
+// Copy the peeked string out and release its record
+static char *copy_and_release(BoundedBuffer *bb, const char *record, size_t length)
+{
+    char *str = (char *)malloc(length + 1); // Make a copy of the string to return
+    if (str != NULL) {
+        memcpy(str, record, length + 1);
+    }
+    release_bounded_buffer(bb);
+    if (str == NULL) {
+        fail("Error copying string from BoundedBuffer");
+    }
+    return str;
+}
+
+char *remove_bounded_buffer(BoundedBuffer *bb)
+{
+    size_t length;
+    const char *record = peek_bounded_buffer_record(bb, &length);
+    return copy_and_release(bb, record, length);
+}
+
+char *try_remove_bounded_buffer(BoundedBuffer *bb)
+{
+    size_t length;
+    const char *record = try_peek_bounded_buffer_record(bb, &length);
+    return record != NULL ? copy_and_release(bb, record, length) : NULL;
+}
+
+void destroy_bounded_buffer(BoundedBuffer *bb)
+{
+    free(bb->data);
+    free(bb);
+}
@@ -0,0 +1,75 @@
+// bounded_buffer.h
+// Bounded queue of strings shared by the C pipelines (main.c, main_old.c, Yuval_test.c).
+// Build it once as a static library and link every pipeline against it:
+//   cc -O2 -c bounded_buffer.c && ar rcs libboundedbuffer.a bounded_buffer.o
+#ifndef BOUNDED_BUFFER_H
+#define BOUNDED_BUFFER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bytes reserve_bounded_buffer sets aside for a string, including the terminating null
+#define BOUNDED_BUFFER_MAX_STRING 100
+
+typedef struct BoundedBuffer BoundedBuffer;
+typedef struct BufferSignal BufferSignal;
+
+// Strings are stored back to back in a byte ring, each taking its own length plus an 8 byte header,
+// rounded up to 8 bytes. The buffer is bounded by bytes: producers wait until the ring has room.
+// A string whose record would take more than half the ring is copied to the heap instead and takes a
+// 16 byte pointer record, so strings of any length up to 4 GB pass through any ring.
+// It is lock free: producers claim bytes with a compare and swap, or a plain store when the buffer has
+// a single producer, and publish each string with a release store. Threads that find the ring full or
+// empty spin briefly, then sleep on a futex. Every buffer has exactly one consumer thread at a time.
+#define BOUNDED_BUFFER_SINGLE_PRODUCER 1   // Only one thread at a time inserts, reserve skips the compare and swap
+
+BoundedBuffer *create_bounded_buffer_bytes(size_t capacity, int flags);
+// A ring with room for size strings of BOUNDED_BUFFER_MAX_STRING bytes, and for more shorter ones
+BoundedBuffer *create_bounded_buffer(int size);
+BoundedBuffer *create_single_producer_bounded_buffer(int size);
+// Return 0, or -1 with errno set if the string could not be stored (ENOMEM for a failed heap copy)
+int insert_bounded_buffer(BoundedBuffer *bb, const char *str);
+// Wait for a string and return a copy of it, the caller frees the copy
+char *remove_bounded_buffer(BoundedBuffer *bb);
+// Like remove_bounded_buffer, but return NULL right away if the buffer is empty
+char *try_remove_bounded_buffer(BoundedBuffer *bb);
+void destroy_bounded_buffer(BoundedBuffer *bb);
+
+// Zero-copy access. reserve waits for room and returns it, the producer writes a null terminated string
+// of at most the reserved length (BOUNDED_BUFFER_MAX_STRING for reserve_bounded_buffer) into it, and commit
+// publishes it; a single producer buffer keeps only the bytes the string uses. reserve returns NULL with
+// errno set, and nothing to commit, if length is 0 or above 4 GB or the heap copy cannot be allocated.
+// peek waits for the oldest string and returns it in place, release frees its bytes once the consumer is
+// done reading. A thread holds at most one reservation at a time; other producers keep reserving meanwhile.
+char *reserve_bounded_buffer(BoundedBuffer *bb);
+char *reserve_bounded_buffer_length(BoundedBuffer *bb, size_t length);
+void commit_bounded_buffer(BoundedBuffer *bb);
+const char *peek_bounded_buffer(BoundedBuffer *bb);
+// Like peek_bounded_buffer, and store the string length, without the null, in length
+const char *peek_bounded_buffer_record(BoundedBuffer *bb, size_t *length);
+// Like peek_bounded_buffer, but return NULL right away if the buffer is empty; release only after a string was returned
+const char *try_peek_bounded_buffer(BoundedBuffer *bb);
+const char *try_peek_bounded_buffer_record(BoundedBuffer *bb, size_t *length);
+void release_bounded_buffer(BoundedBuffer *bb);
+// Number of committed strings not yet released, without locking; only a hint while other threads run
+int bounded_buffer_count(BoundedBuffer *bb);
+
+// A "data available" sequence shared by several buffers, so one consumer can sleep until any of them
+// gets a string. Every commit into an attached buffer bumps the sequence and wakes the sleepers.
+// Read the sequence, drain the buffers, then wait for the sequence to move past the value read.
+BufferSignal *create_buffer_signal(void);
+void destroy_buffer_signal(BufferSignal *signal);
+// Attach before any producer uses the buffer
+void attach_buffer_signal(BoundedBuffer *bb, BufferSignal *signal);
+unsigned read_buffer_signal(BufferSignal *signal);
+// Sleep until the sequence differs from seen, return the new sequence
+unsigned wait_buffer_signal(BufferSignal *signal, unsigned seen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOUNDED_BUFFER_H
@@ -1,18 +1,532 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "buffered_open.h"
 
-buffered_file_t *buffered_open(const char *pathname, int flags, ...) 
+// Bytes moved per step when existing data is shifted behind the prepended data
+#define SHIFT_CHUNK (256 * 1024)
+
+static int full_pwrite(int fd, const char *buf, size_t count, off_t offset)
 {
-    buffered_file_t *bfile = (buffered_file_t *)malloc(sizeof(buffered_file_t));
-    if (!bfile) {
+    while (count > 0) {
+        ssize_t written = pwrite(fd, buf, count, offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        count -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static int full_pread(int fd, char *buf, size_t count, off_t offset)
+{
+    while (count > 0) {
+        ssize_t read_bytes = pread(fd, buf, count, offset);
+        if (read_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (read_bytes == 0) {
+            errno = EIO;
+            return -1;
+        }
+        buf += read_bytes;
+        count -= read_bytes;
+        offset += read_bytes;
+    }
+    return 0;
+}
+
+// Buffers are page aligned, which keeps large transfers aligned for the kernel
+static char *allocate_buffer(size_t size)
+{
+    void *buffer;
+    long page_size = sysconf(_SC_PAGESIZE);
+    int error = posix_memalign(&buffer, page_size > 0 ? (size_t)page_size : BUFFER_SIZE, size);
+    if (error != 0) {
+        errno = error;
         return NULL;
     }
+    return (char *)buffer;
+}
+
+// Double an empty buffer, up to max_capacity; keep the old one if there is no memory for a bigger one
+static void grow_buffer(char **buffer, size_t *capacity, size_t max_capacity)
+{
+    if (*capacity >= max_capacity) {
+        return;
+    }
+    size_t new_capacity = (*capacity * 2 < max_capacity) ? *capacity * 2 : max_capacity;
+    char *new_buffer = allocate_buffer(new_capacity);
+    if (new_buffer) {
+        free(*buffer);
+        *buffer = new_buffer;
+        *capacity = new_capacity;
+    }
+}
+
+// Forget the unread part of the read buffer and move the file offset back to it, for when the
+// content it was read from changes
+static void drop_read_buffer(buffered_file_t *bfile)
+{
+    // The file offset jumps back, whatever was prefetched is no longer ahead of it
+    bfile->readahead_streak = 0;
+    bfile->readahead_left = 0;
+    if (bfile->read_buffer_pos < bfile->read_buffer_size) {
+        lseek(bfile->fd, -(off_t)(bfile->read_buffer_size - bfile->read_buffer_pos), SEEK_CUR);
+    }
+    bfile->read_buffer_pos = bfile->read_buffer_size = 0;
+}
+
+// Append a flush of prepended data to the spill file, the file itself is not touched.
+// The spill file is a journal of segments whose logical order is the reverse of their order in it.
+static int queue_prepend(buffered_file_t *bfile, const char *data, size_t count)
+{
+    if (bfile->prepend_fd == -1) {
+        const char *dir = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/buffered_prepend_XXXXXX", dir ? dir : "/tmp");
+        bfile->prepend_fd = mkstemp(path);
+        if (bfile->prepend_fd == -1) {
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bfile->prepend_count == bfile->prepend_capacity) {
+        size_t capacity = bfile->prepend_capacity ? bfile->prepend_capacity * 2 : 16;
+        off_t *segments = (off_t *)realloc(bfile->prepend_segments, capacity * sizeof(off_t));
+        if (!segments) {
+            errno = ENOMEM;
+            return -1;
+        }
+        bfile->prepend_segments = segments;
+        bfile->prepend_capacity = capacity;
+    }
+    if (full_pwrite(bfile->prepend_fd, data, count, bfile->prepend_size) == -1) {
+        return -1;
+    }
+    bfile->prepend_segments[bfile->prepend_count++] = bfile->prepend_size;
+    bfile->prepend_size += count;
+    // Everything after the read position moved back by count bytes
+    drop_read_buffer(bfile);
+    return 0;
+}
+
+// Read from the logical content, the queued prepends newest first followed by the file, at logical
+// offset position without moving the file offset
+static ssize_t overlay_pread(buffered_file_t *bfile, char *buf, size_t count, off_t position)
+{
+    off_t journal_size = bfile->prepend_size;
+    if (position >= journal_size) {
+        return pread(bfile->fd, buf, count, position - journal_size);
+    }
+
+    // Logical offset position is distance bytes before the end of the spill file; find the segment
+    // holding it, the last one starting before that spill offset
+    off_t distance = journal_size - position;
+    size_t low = 0, high = bfile->prepend_count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (bfile->prepend_segments[middle] < distance) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    off_t start = bfile->prepend_segments[low];
+    off_t end = (low + 1 < bfile->prepend_count) ? bfile->prepend_segments[low + 1] : journal_size;
+    size_t available = (size_t)(distance - start);
+    if (count > available) {
+        count = available;
+    }
+    return pread(bfile->prepend_fd, buf, count, start + (end - distance));
+}
+
+// Called after each read of length bytes at the file offset. From the second read in a row, keep
+// readahead_depth read buffers prefetched ahead of the offset: posix_fadvise WILLNEED starts the reads in
+// the background, a refill then finds its pages cached. The window is topped up when half of it was read.
+static void read_ahead(buffered_file_t *bfile, size_t length)
+{
+    if (bfile->readahead_depth == 0 || ++bfile->readahead_streak < 2) {
+        return;
+    }
+    size_t window = bfile->readahead_depth * bfile->read_capacity;
+    bfile->readahead_left = bfile->readahead_left > length ? bfile->readahead_left - length : 0;
+    if (bfile->readahead_left >= window / 2) {
+        return;
+    }
+    off_t position = lseek(bfile->fd, 0, SEEK_CUR);
+    if (position == -1) {
+        return;
+    }
+    // Only the part past the previous window is new
+    posix_fadvise(bfile->fd, position + bfile->readahead_left, window - bfile->readahead_left, POSIX_FADV_WILLNEED);
+    bfile->readahead_left = window;
+}
+
+// Read at the file offset into buf, the read buffer or the caller's memory. With prepends queued the
+// file offset is a position in the logical content, which is read through the journal.
+static ssize_t read_at_offset(buffered_file_t *bfile, char *buf, size_t count)
+{
+    if (bfile->prepend_count == 0) {
+        ssize_t read_bytes = read(bfile->fd, buf, count);
+        if (read_bytes > 0) {
+            read_ahead(bfile, read_bytes);
+        }
+        return read_bytes;
+    }
+    off_t position = lseek(bfile->fd, 0, SEEK_CUR);
+    if (position == -1) {
+        return -1;
+    }
+    ssize_t read_bytes = overlay_pread(bfile, buf, count, position);
+    if (read_bytes > 0 && lseek(bfile->fd, position + read_bytes, SEEK_SET) == -1) {
+        return -1;
+    }
+    return read_bytes;
+}
+
+// Map the file, or extend the mapping when the file grew, so it covers the whole file. An empty file is left unmapped.
+static int update_map(buffered_file_t *bfile)
+{
+    struct stat st;
+    if (fstat(bfile->fd, &st) == -1) {
+        return -1;
+    }
+    if ((size_t)st.st_size <= bfile->map_size) {
+        return 0;
+    }
+
+    char *map;
+    if (bfile->map) {
+        map = (char *)mremap(bfile->map, bfile->map_size, st.st_size, MREMAP_MAYMOVE);
+    } else {
+        // Reading continues at the file offset, minus whatever the read buffer still holds
+        drop_read_buffer(bfile);
+        off_t position = lseek(bfile->fd, 0, SEEK_CUR);
+        if (position == -1) {
+            return -1;
+        }
+        bfile->map_pos = position;
+        map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, bfile->fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    bfile->map = map;
+    bfile->map_size = st.st_size;
+    return 0;
+}
+
+// Unmap before writing and move the file offset to the read position, writes go where reading stopped
+static int leave_map(buffered_file_t *bfile)
+{
+    if (!bfile->map) {
+        return 0;
+    }
+    if (lseek(bfile->fd, bfile->map_pos, SEEK_SET) == -1) {
+        return -1;
+    }
+    munmap(bfile->map, bfile->map_size);
+    bfile->map = NULL;
+    bfile->map_size = 0;
+    return 0;
+}
+
+// Read into the iovec array until it is full or the file ends, return the bytes read; the array is consumed
+static ssize_t full_readv(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    while (iovcnt > 0) {
+        ssize_t read_bytes = readv(fd, iov, iovcnt);
+        if (read_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (read_bytes == 0) {
+            break;
+        }
+        total += read_bytes;
+        while (iovcnt > 0 && (size_t)read_bytes >= iov->iov_len) {
+            read_bytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + read_bytes;
+            iov->iov_len -= read_bytes;
+        }
+    }
+    return total;
+}
+
+// Write every byte of the iovec array, continuing after short writes; the array is consumed
+static int full_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Make room for shift bytes at the start of the file. The kernel inserts whole blocks without moving
+// data when the filesystem supports it, otherwise the data is moved back chunk by chunk from the end.
+static int shift_file(int fd, off_t size, off_t shift, char *chunk)
+{
+#ifdef FALLOC_FL_INSERT_RANGE
+    struct stat st;
+    if (size > 0 && fstat(fd, &st) == 0 && st.st_blksize > 0 && shift % st.st_blksize == 0 &&
+        fallocate(fd, FALLOC_FL_INSERT_RANGE, 0, shift) == 0) {
+        return 0;
+    }
+#endif
+    off_t offset = size;
+    while (offset > 0) {
+        size_t length = offset < SHIFT_CHUNK ? (size_t)offset : SHIFT_CHUNK;
+        offset -= length;
+        if (full_pread(fd, chunk, length, offset) == -1 || full_pwrite(fd, chunk, length, offset + shift) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Copy the queued prepends to the start of the file, newest flush first
+static int write_prepends(buffered_file_t *bfile, char *chunk)
+{
+    off_t offset = 0;
+    for (size_t i = bfile->prepend_count; i-- > 0;) {
+        off_t start = bfile->prepend_segments[i];
+        off_t end = (i + 1 < bfile->prepend_count) ? bfile->prepend_segments[i + 1] : bfile->prepend_size;
+        while (start < end) {
+            size_t length = (end - start < SHIFT_CHUNK) ? (size_t)(end - start) : SHIFT_CHUNK;
+            if (full_pread(bfile->prepend_fd, chunk, length, start) == -1 ||
+                full_pwrite(bfile->fd, chunk, length, offset) == -1) {
+                return -1;
+            }
+            start += length;
+            offset += length;
+        }
+    }
+    return 0;
+}
+
+// Place every queued prepend in front of the file contents in one pass, newest flush first.
+// Uses SHIFT_CHUNK bytes of memory whatever the file size, the file offset is left where it was.
+static int materialize_prepends(buffered_file_t *bfile)
+{
+    if (bfile->prepend_count == 0) {
+        return 0;
+    }
+
+    // The logical content does not change, but it moves from the journal into the file
+    drop_read_buffer(bfile);
+
+    // pwrite ignores the offset of an O_APPEND descriptor, drop the flag while rewriting
+    int status_flags = fcntl(bfile->fd, F_GETFL);
+    if (status_flags == -1 || ((status_flags & O_APPEND) && fcntl(bfile->fd, F_SETFL, status_flags & ~O_APPEND) == -1)) {
+        return -1;
+    }
+
+    int result = -1;
+    struct stat st;
+    char *chunk = (char *)malloc(SHIFT_CHUNK);
+    if (!chunk) {
+        errno = ENOMEM;
+    } else if (fstat(bfile->fd, &st) == 0 && shift_file(bfile->fd, st.st_size, bfile->prepend_size, chunk) == 0) {
+        result = write_prepends(bfile, chunk);
+    }
+    free(chunk);
+
+    if (status_flags & O_APPEND) {
+        fcntl(bfile->fd, F_SETFL, status_flags);
+    }
+    if (result == 0) {
+        bfile->prepend_count = 0;
+        bfile->prepend_size = 0;
+        if (ftruncate(bfile->prepend_fd, 0) == -1) {
+            return -1;
+        }
+    }
+    return result;
+}
+
+// Flusher thread of write-behind mode: writes the handed buffers in the order they were handed over
+static void *write_behind_thread(void *args)
+{
+    buffered_file_t *bfile = (buffered_file_t *)args;
+    pthread_mutex_lock(&bfile->behind_mutex);
+    while (1) {
+        while (bfile->behind_pending == 0 && !bfile->behind_stop) {
+            pthread_cond_wait(&bfile->behind_queued, &bfile->behind_mutex);
+        }
+        if (bfile->behind_pending == 0) {
+            break;
+        }
+        size_t index = bfile->behind_first;
+        pthread_mutex_unlock(&bfile->behind_mutex);
+
+        // The caller is filling another buffer meanwhile
+        struct iovec iov = { bfile->behind_buffers[index], bfile->behind_lengths[index] };
+        int result = full_writev(bfile->fd, &iov, 1);
+
+        pthread_mutex_lock(&bfile->behind_mutex);
+        if (result == -1 && bfile->behind_error == 0) {
+            bfile->behind_error = errno;
+        }
+        bfile->behind_first = (bfile->behind_first + 1) % bfile->behind_count;
+        bfile->behind_pending--;
+        pthread_cond_broadcast(&bfile->behind_written);
+    }
+    pthread_mutex_unlock(&bfile->behind_mutex);
+    return NULL;
+}
+
+// Allocate count write buffers, the existing write buffer being the first, and start the flusher
+static int start_write_behind(buffered_file_t *bfile, size_t count)
+{
+    bfile->behind_buffers = (char **)calloc(count, sizeof(char *));
+    bfile->behind_lengths = (size_t *)calloc(count, sizeof(size_t));
+    if (!bfile->behind_buffers || !bfile->behind_lengths) {
+        free(bfile->behind_buffers);
+        free(bfile->behind_lengths);
+        errno = ENOMEM;
+        return -1;
+    }
+    bfile->behind_buffers[0] = bfile->write_buffer;
+    for (size_t i = 1; i < count; i++) {
+        bfile->behind_buffers[i] = allocate_buffer(bfile->write_capacity);
+        if (!bfile->behind_buffers[i]) {
+            for (size_t j = 1; j < i; j++) {
+                free(bfile->behind_buffers[j]);
+            }
+            free(bfile->behind_buffers);
+            free(bfile->behind_lengths);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    bfile->behind_count = count;
+    bfile->behind_first = 0;
+    bfile->behind_pending = 0;
+    bfile->behind_error = 0;
+    bfile->behind_stop = 0;
+    pthread_mutex_init(&bfile->behind_mutex, NULL);
+    pthread_cond_init(&bfile->behind_queued, NULL);
+    pthread_cond_init(&bfile->behind_written, NULL);
+    int error = pthread_create(&bfile->behind_thread, NULL, write_behind_thread, bfile);
+    if (error != 0) {
+        for (size_t i = 1; i < count; i++) {
+            free(bfile->behind_buffers[i]);
+        }
+        free(bfile->behind_buffers);
+        free(bfile->behind_lengths);
+        bfile->behind_count = 0;
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+// Hand the filled part of the write buffer to the flusher and continue in a free buffer, waiting only
+// when every buffer is in flight
+static int hand_off_buffer(buffered_file_t *bfile)
+{
+    pthread_mutex_lock(&bfile->behind_mutex);
+    size_t index = (bfile->behind_first + bfile->behind_pending) % bfile->behind_count;
+    bfile->behind_lengths[index] = bfile->write_buffer_pos;
+    bfile->behind_pending++;
+    pthread_cond_signal(&bfile->behind_queued);
+    while (bfile->behind_pending == bfile->behind_count) {
+        pthread_cond_wait(&bfile->behind_written, &bfile->behind_mutex);
+    }
+    bfile->write_buffer = bfile->behind_buffers[(bfile->behind_first + bfile->behind_pending) % bfile->behind_count];
+    int error = bfile->behind_error;
+    pthread_mutex_unlock(&bfile->behind_mutex);
+
+    bfile->write_buffer_pos = 0;
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+// Wait until the flusher wrote every handed buffer, report and clear a failed background write
+static int wait_written(buffered_file_t *bfile)
+{
+    pthread_mutex_lock(&bfile->behind_mutex);
+    while (bfile->behind_pending > 0) {
+        pthread_cond_wait(&bfile->behind_written, &bfile->behind_mutex);
+    }
+    int error = bfile->behind_error;
+    bfile->behind_error = 0;
+    pthread_mutex_unlock(&bfile->behind_mutex);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
 
+// Stop the flusher once it is idle and free the write-behind buffers, write_buffer among them
+static void stop_write_behind(buffered_file_t *bfile)
+{
+    pthread_mutex_lock(&bfile->behind_mutex);
+    bfile->behind_stop = 1;
+    pthread_cond_signal(&bfile->behind_queued);
+    pthread_mutex_unlock(&bfile->behind_mutex);
+    pthread_join(bfile->behind_thread, NULL);
+
+    pthread_mutex_destroy(&bfile->behind_mutex);
+    pthread_cond_destroy(&bfile->behind_queued);
+    pthread_cond_destroy(&bfile->behind_written);
+    for (size_t i = 0; i < bfile->behind_count; i++) {
+        free(bfile->behind_buffers[i]);
+    }
+    free(bfile->behind_buffers);
+    free(bfile->behind_lengths);
+    bfile->write_buffer = NULL;
+    bfile->behind_count = 0;
+}
+
+buffered_file_t *buffered_open(const char *pathname, int flags, ...) 
+{
     va_list arg_list;
     va_start(arg_list, flags);
     mode_t file_mode = 0;
@@ -21,22 +535,43 @@ buffered_file_t *buffered_open(const char *pathname, int flags, ...)
     }
     va_end(arg_list);
 
+    return buffered_open_ex(pathname, flags, file_mode, NULL);
+}
+
+buffered_file_t *buffered_open_ex(const char *pathname, int flags, mode_t mode, const buffered_options_t *options)
+{
+    buffered_file_t *bfile = (buffered_file_t *)malloc(sizeof(buffered_file_t));
+    if (!bfile) {
+        return NULL;
+    }
+
+    bfile->read_capacity = (options && options->read_buffer_size) ? options->read_buffer_size : BUFFER_SIZE;
+    bfile->write_capacity = (options && options->write_buffer_size) ? options->write_buffer_size : BUFFER_SIZE;
+    bfile->max_capacity = options ? options->max_buffer_size : 0;
+
     bfile->preappend = (flags & O_PREAPPEND) ? 1 : 0;
-    flags &= ~O_PREAPPEND;
+    // The mapping holds the file as it is on disk, queued prepends are not in it
+    bfile->mmapread = ((flags & O_MMAPREAD) && !bfile->preappend) ? 1 : 0;
+    flags &= ~(O_PREAPPEND | O_MMAPREAD);
+    if (bfile->preappend && (flags & O_ACCMODE) == O_WRONLY) {
+        // Prepending moves the existing data, which needs read access
+        flags = (flags & ~O_ACCMODE) | O_RDWR;
+    }
 
-    bfile->fd = open(pathname, flags, file_mode);
+    bfile->fd = open(pathname, flags, mode);
     if (bfile->fd == -1) {
         free(bfile);
         return NULL;
     }
 
-    bfile->read_buffer = (char *)malloc(BUFFER_SIZE);
-    bfile->write_buffer = (char *)malloc(BUFFER_SIZE);
+    bfile->read_buffer = allocate_buffer(bfile->read_capacity);
+    bfile->write_buffer = allocate_buffer(bfile->write_capacity);
     if (!bfile->read_buffer || !bfile->write_buffer) {
         close(bfile->fd);
         free(bfile->read_buffer);
         free(bfile->write_buffer);
         free(bfile);
+        errno = ENOMEM;
         return NULL;
     }
 
@@ -46,6 +581,37 @@ buffered_file_t *buffered_open(const char *pathname, int flags, ...)
     bfile->write_buffer_pos = 0;
     bfile->flags = flags;
 
+    bfile->prepend_fd = -1;
+    bfile->prepend_segments = NULL;
+    bfile->prepend_count = 0;
+    bfile->prepend_capacity = 0;
+    bfile->prepend_size = 0;
+
+    bfile->map = NULL;
+    bfile->map_size = 0;
+    bfile->map_pos = 0;
+
+    bfile->readahead_depth = options ? options->read_ahead_buffers : 0;
+    bfile->readahead_streak = 0;
+    bfile->readahead_left = 0;
+    if (bfile->readahead_depth && !bfile->mmapread) {
+        // Also doubles the kernel's own read-ahead window for the file
+        posix_fadvise(bfile->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    bfile->behind_count = 0;
+    size_t behind_buffers = options ? options->write_behind_buffers : 0;
+    if (behind_buffers >= 2 && !bfile->preappend && (flags & O_ACCMODE) != O_RDONLY &&
+        start_write_behind(bfile, behind_buffers) == -1) {
+        int error = errno;
+        close(bfile->fd);
+        free(bfile->read_buffer);
+        free(bfile->write_buffer);
+        free(bfile);
+        errno = error;
+        return NULL;
+    }
+
     return bfile;
 }
 
@@ -54,8 +620,36 @@ ssize_t buffered_write(buffered_file_t *bfile, const void *buf, size_t count)
     const char *input_buf = (const char *)buf;
     size_t bytes_left = count;
 
+    if (leave_map(bfile) == -1) {
+        return -1;
+    }
+    // Writing moves the file offset, reads are no longer sequential
+    bfile->readahead_streak = 0;
+    bfile->readahead_left = 0;
+
+    if (!bfile->preappend && !bfile->behind_count && bytes_left >= bfile->write_capacity) {
+        // At least a whole buffer: one writev sends the buffered bytes and the caller's data without copying it.
+        // Smaller writes still fill the buffer, so a stream of them reaches the growth below.
+        // Prepends keep going through the buffer, their flush boundaries decide the order in the file.
+        // In write-behind mode the copy is cheaper than waiting for the disk.
+        struct iovec iov[2] = {
+            { bfile->write_buffer, bfile->write_buffer_pos },
+            { (void *)input_buf, bytes_left },
+        };
+        int first = bfile->write_buffer_pos > 0 ? 0 : 1;
+        if (full_writev(bfile->fd, iov + first, 2 - first) == -1) {
+            return -1;
+        }
+        bfile->write_buffer_pos = 0;
+        // Buffered bytes went out with the data, as if the buffer had filled: the caller is streaming
+        if (first == 0) {
+            grow_buffer(&bfile->write_buffer, &bfile->write_capacity, bfile->max_capacity);
+        }
+        return count;
+    }
+
     while (bytes_left > 0) {
-        size_t buffer_space = BUFFER_SIZE - bfile->write_buffer_pos;
+        size_t buffer_space = bfile->write_capacity - bfile->write_buffer_pos;
         size_t write_bytes = (bytes_left < buffer_space) ? bytes_left : buffer_space;
 
         memcpy(bfile->write_buffer + bfile->write_buffer_pos, input_buf, write_bytes);
@@ -63,18 +657,26 @@ ssize_t buffered_write(buffered_file_t *bfile, const void *buf, size_t count)
         input_buf += write_bytes;
         bytes_left -= write_bytes;
 
-        if (bfile->write_buffer_pos == BUFFER_SIZE) {
+        if (bfile->write_buffer_pos == bfile->write_capacity) {
             if (bfile->preappend) {
                 if (buffered_flush(bfile) == -1) {
                     return -1;
                 }
+            } else if (bfile->behind_count) {
+                if (hand_off_buffer(bfile) == -1) {
+                    return -1;
+                }
             } else {
-                ssize_t written_bytes = write(bfile->fd, bfile->write_buffer, BUFFER_SIZE);
+                ssize_t written_bytes = write(bfile->fd, bfile->write_buffer, bfile->write_capacity);
                 if (written_bytes == -1) {
                     return -1;
                 }
                 bfile->write_buffer_pos = 0;
             }
+            // The caller is streaming: fewer, larger writes from now on. Write-behind buffers keep their size.
+            if (!bfile->behind_count) {
+                grow_buffer(&bfile->write_buffer, &bfile->write_capacity, bfile->max_capacity);
+            }
         }
     }
 
@@ -90,16 +692,51 @@ ssize_t buffered_read(buffered_file_t *bfile, void *buf, size_t count)
     char *output_buf = (char *)buf;
     size_t bytes_left = count;
 
+    if (bfile->mmapread) {
+        // Check the file size only when the mapping runs out, a scan within it makes no syscalls
+        if (bfile->map_pos + bytes_left > bfile->map_size && update_map(bfile) == -1) {
+            return -1;
+        }
+        if (bfile->map) {
+            size_t available = bfile->map_pos < bfile->map_size ? bfile->map_size - bfile->map_pos : 0;
+            size_t read_bytes = bytes_left < available ? bytes_left : available;
+            memcpy(output_buf, bfile->map + bfile->map_pos, read_bytes);
+            bfile->map_pos += read_bytes;
+            return read_bytes;
+        }
+        // Still empty, nothing to map
+    }
+
     while (bytes_left > 0) {
         if (bfile->read_buffer_pos == bfile->read_buffer_size) {
-            bfile->read_buffer_size = read(bfile->fd, bfile->read_buffer, BUFFER_SIZE);
-            if (bfile->read_buffer_size == -1) {
+            if (bfile->read_buffer_size == bfile->read_capacity) {
+                // The whole previous buffer was read sequentially, read more at once
+                grow_buffer(&bfile->read_buffer, &bfile->read_capacity, bfile->max_capacity);
+            }
+            if (bytes_left >= bfile->read_capacity) {
+                // The buffer is empty and would only be copied out again, read straight into the caller's memory
+                ssize_t read_bytes = read_at_offset(bfile, output_buf, bytes_left);
+                if (read_bytes == -1) {
+                    return -1;
+                }
+                bfile->read_buffer_size = bfile->read_buffer_pos = 0;
+                if (read_bytes == 0) {
+                    break;
+                }
+                output_buf += read_bytes;
+                bytes_left -= read_bytes;
+                continue;
+            }
+            ssize_t filled = read_at_offset(bfile, bfile->read_buffer, bfile->read_capacity);
+            if (filled == -1) {
                 return -1;
             }
-            if (bfile->read_buffer_size == 0) {
+            // Reset the position at end of file too, so a later read does not see stale bytes
+            bfile->read_buffer_size = filled;
+            bfile->read_buffer_pos = 0;
+            if (filled == 0) {
                 break;
             }
-            bfile->read_buffer_pos = 0;
         }
 
         size_t read_bytes = bfile->read_buffer_size - bfile->read_buffer_pos;
@@ -116,41 +753,155 @@ ssize_t buffered_read(buffered_file_t *bfile, void *buf, size_t count)
     return count - bytes_left;
 }
 
-int buffered_flush(buffered_file_t *bfile) 
+// Pieces up to this count are passed to writev and readv from a stack array
+#define STACK_IOVECS 64
+
+ssize_t buffered_writev(buffered_file_t *bfile, const struct iovec *iov, int iovcnt)
 {
-    if (bfile->write_buffer_pos > 0) {
-        if (bfile->preappend) {
-            off_t end_offset = lseek(bfile->fd, 0, SEEK_END);
-            if (end_offset == -1) {
-                return -1;
-            }
-            char *temp_buf = (char *)malloc(end_offset);
-            if (!temp_buf) {
-                errno = ENOMEM;
-                return -1;
-            }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
 
-            lseek(bfile->fd, 0, SEEK_SET);
-            ssize_t read_bytes = read(bfile->fd, temp_buf, end_offset);
-            if (read_bytes == -1) {
-                free(temp_buf);
-                return -1;
-            }
+    if (leave_map(bfile) == -1) {
+        return -1;
+    }
+    // Writing moves the file offset, reads are no longer sequential
+    bfile->readahead_streak = 0;
+    bfile->readahead_left = 0;
 
-            lseek(bfile->fd, 0, SEEK_SET);
-            ssize_t written_bytes = write(bfile->fd, bfile->write_buffer, bfile->write_buffer_pos);
-            if (written_bytes == -1) {
-                free(temp_buf);
-                return -1;
-            }
+    if (!bfile->preappend && !bfile->behind_count && iovcnt < STACK_IOVECS && total > bfile->write_capacity - bfile->write_buffer_pos) {
+        // Same as a large buffered_write: the buffered bytes and every piece in one writev
+        struct iovec pieces[STACK_IOVECS];
+        pieces[0].iov_base = bfile->write_buffer;
+        pieces[0].iov_len = bfile->write_buffer_pos;
+        memcpy(pieces + 1, iov, iovcnt * sizeof(struct iovec));
+        int first = bfile->write_buffer_pos > 0 ? 0 : 1;
+        if (full_writev(bfile->fd, pieces + first, iovcnt + 1 - first) == -1) {
+            return -1;
+        }
+        bfile->write_buffer_pos = 0;
+        return total;
+    }
 
-            written_bytes = write(bfile->fd, temp_buf, end_offset);
-            if (written_bytes == -1) {
-                free(temp_buf);
+    for (int i = 0; i < iovcnt; i++) {
+        if (buffered_write(bfile, iov[i].iov_base, iov[i].iov_len) == -1) {
+            return -1;
+        }
+    }
+    return total;
+}
+
+ssize_t buffered_readv(buffered_file_t *bfile, const struct iovec *iov, int iovcnt)
+{
+    if (buffered_flush(bfile) == -1) {
+        return -1;
+    }
+
+    // Hand out what the read buffer still holds
+    size_t total = 0;
+    int i = 0;
+    size_t piece_offset = 0;
+    while (i < iovcnt && bfile->read_buffer_pos < bfile->read_buffer_size) {
+        size_t copy = bfile->read_buffer_size - bfile->read_buffer_pos;
+        if (copy > iov[i].iov_len - piece_offset) {
+            copy = iov[i].iov_len - piece_offset;
+        }
+        memcpy((char *)iov[i].iov_base + piece_offset, bfile->read_buffer + bfile->read_buffer_pos, copy);
+        bfile->read_buffer_pos += copy;
+        piece_offset += copy;
+        total += copy;
+        if (piece_offset == iov[i].iov_len) {
+            i++;
+            piece_offset = 0;
+        }
+    }
+
+    size_t left = 0;
+    for (int j = i; j < iovcnt; j++) {
+        left += iov[j].iov_len;
+    }
+    left -= piece_offset;
+
+    // While mapped every piece is copied from the mapping, the file offset is not the read position
+    if (!bfile->map && bfile->prepend_count == 0 && iovcnt - i < STACK_IOVECS && left >= bfile->read_capacity) {
+        // The rest is at least a buffer's worth, one readv fills the pieces directly
+        struct iovec pieces[STACK_IOVECS];
+        memcpy(pieces, iov + i, (iovcnt - i) * sizeof(struct iovec));
+        pieces[0].iov_base = (char *)pieces[0].iov_base + piece_offset;
+        pieces[0].iov_len -= piece_offset;
+        ssize_t read_bytes = full_readv(bfile->fd, pieces, iovcnt - i);
+        if (read_bytes == -1) {
+            return -1;
+        }
+        bfile->read_buffer_size = bfile->read_buffer_pos = 0;
+        return total + read_bytes;
+    }
+
+    for (; i < iovcnt; i++) {
+        size_t wanted = iov[i].iov_len - piece_offset;
+        ssize_t read_bytes = buffered_read(bfile, (char *)iov[i].iov_base + piece_offset, wanted);
+        if (read_bytes == -1) {
+            return -1;
+        }
+        total += read_bytes;
+        piece_offset = 0;
+        if ((size_t)read_bytes < wanted) {
+            break;
+        }
+    }
+    return total;
+}
+
+int buffered_peek(buffered_file_t *bfile, const void **data, size_t *length)
+{
+    if (buffered_flush(bfile) == -1) {
+        return -1;
+    }
+
+    if (bfile->mmapread) {
+        if (bfile->map_pos >= bfile->map_size && update_map(bfile) == -1) {
+            return -1;
+        }
+        if (bfile->map) {
+            *data = bfile->map + bfile->map_pos;
+            *length = bfile->map_pos < bfile->map_size ? bfile->map_size - bfile->map_pos : 0;
+            return 0;
+        }
+    }
+
+    if (bfile->read_buffer_pos == bfile->read_buffer_size) {
+        ssize_t filled = read_at_offset(bfile, bfile->read_buffer, bfile->read_capacity);
+        if (filled == -1) {
+            return -1;
+        }
+        bfile->read_buffer_size = filled;
+        bfile->read_buffer_pos = 0;
+    }
+    *data = bfile->read_buffer + bfile->read_buffer_pos;
+    *length = bfile->read_buffer_size - bfile->read_buffer_pos;
+    return 0;
+}
+
+void buffered_consume(buffered_file_t *bfile, size_t count)
+{
+    if (bfile->map) {
+        bfile->map_pos += count;
+    } else {
+        bfile->read_buffer_pos += count;
+    }
+}
+
+int buffered_flush(buffered_file_t *bfile) 
+{
+    if (bfile->write_buffer_pos > 0) {
+        if (bfile->preappend) {
+            if (queue_prepend(bfile, bfile->write_buffer, bfile->write_buffer_pos) == -1) {
                 return -1;
             }
-
-            free(temp_buf);
+        } else if (bfile->behind_count) {
+            // A failed background write is reported below, once, when everything handed over was written
+            hand_off_buffer(bfile);
         } else {
             ssize_t written_bytes = write(bfile->fd, bfile->write_buffer, bfile->write_buffer_pos);
             if (written_bytes == -1) {
@@ -160,20 +911,42 @@ int buffered_flush(buffered_file_t *bfile)
         bfile->write_buffer_pos = 0;
     }
 
+    if (bfile->behind_count && wait_written(bfile) == -1) {
+        return -1;
+    }
+
     return 0;
 }
 
+int buffered_compact(buffered_file_t *bfile)
+{
+    if (buffered_flush(bfile) == -1) {
+        return -1;
+    }
+    return materialize_prepends(bfile);
+}
+
 int buffered_close(buffered_file_t *bfile) 
 {
     int close_result = 0;
 
-    if (buffered_flush(bfile) == -1) {
+    if (buffered_compact(bfile) == -1) {
         close_result = -1;
     }
 
+    if (bfile->behind_count) {
+        stop_write_behind(bfile);
+    }
+    if (bfile->map) {
+        munmap(bfile->map, bfile->map_size);
+    }
     if (close(bfile->fd) == -1) {
         close_result = -1;
     }
+    if (bfile->prepend_fd != -1) {
+        close(bfile->prepend_fd);
+    }
+    free(bfile->prepend_segments);
 
     free(bfile->read_buffer);
     free(bfile->write_buffer);
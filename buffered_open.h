@@ -2,14 +2,32 @@
 #define BUFFERED_OPEN_H
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 // Define a new flag that doesn't collide with existing flags
 #define O_PREAPPEND 0x40000000
 
+// Flag to serve buffered_read from a read only mapping of the file instead of the read buffer.
+// Ignored with O_PREAPPEND. The file must not be truncated by others while it is mapped.
+#define O_MMAPREAD 0x20000000
+
 // Define the standard buffer size for read and write operations
 #define BUFFER_SIZE 4096
 
+// Buffer sizes for buffered_open_ex, fields left 0 take the defaults
+typedef struct {
+    size_t read_buffer_size;    // Initial size of the read buffer, BUFFER_SIZE if 0
+    size_t write_buffer_size;   // Initial size of the write buffer, BUFFER_SIZE if 0
+    size_t max_buffer_size;     // Adaptive mode when above the initial sizes: a buffer that sequential access
+                                // fills doubles, up to this size
+    size_t write_behind_buffers; // Write-behind mode when 2 or more: write buffers a background thread writes out
+                                // while the caller fills the next one. Fixed size, ignored with O_PREAPPEND.
+    size_t read_ahead_buffers;  // Prefetch depth: once reads are sequential, the kernel is asked to read this many
+                                // read buffers ahead of the reader. 0 leaves read-ahead to the kernel defaults.
+} buffered_options_t;
+
 // Structure to hold the buffer and original flags
 typedef struct {
     int fd;                     // File descriptor for the opened file
@@ -20,26 +38,81 @@ typedef struct {
     size_t read_buffer_size;    // Size of the read buffer, indicating how much data it can hold
     size_t write_buffer_size;   // Size of the write buffer, indicating how much data it can hold
 
+    size_t read_capacity;       // Allocated bytes of the read buffer
+    size_t write_capacity;      // Allocated bytes of the write buffer
+    size_t max_capacity;        // Size the buffers may grow to, no growth if not above their capacity
+
     size_t read_buffer_pos;     // Current position in the read buffer, indicating the next byte to be read
     size_t write_buffer_pos;    // Current position in the write buffer, indicating the next byte to be written
 
     int flags;                  // File flags used to control file access modes and options (like O_RDONLY, O_WRONLY)
 
     int preappend;              // Flag to remember if the O_PREAPPEND flag was used, indicating special handling for writes
+
+    int prepend_fd;             // Unlinked spill file holding flushed prepends until they are placed in the file, -1 if none
+    off_t *prepend_segments;    // Spill offset where each flush starts, the last flush goes first in the file
+    size_t prepend_count;       // Number of flushes in the spill file
+    size_t prepend_capacity;    // Allocated entries of prepend_segments
+    off_t prepend_size;         // Bytes in the spill file
+
+    int mmapread;               // Flag to remember if the O_MMAPREAD flag was used
+    char *map;                  // Mapping reads are served from, NULL until the first read and after a write
+    size_t map_size;            // Bytes of the file covered by the mapping
+    size_t map_pos;             // Read position while mapped, the file offset is only moved when the mapping is left
+
+    size_t behind_count;        // Number of write-behind buffers, 0 when writes are synchronous
+    char **behind_buffers;      // The write-behind buffers, write_buffer is the one being filled
+    size_t *behind_lengths;     // Bytes to write from each buffer handed to the flusher
+    size_t behind_first;        // Oldest buffer handed to the flusher
+    size_t behind_pending;      // Buffers handed to the flusher and not written yet
+    int behind_error;           // errno of a failed background write, reported by the next write or flush
+    int behind_stop;            // Set by buffered_close to end the flusher
+    pthread_t behind_thread;    // Flusher thread, writes the handed buffers in order
+    pthread_mutex_t behind_mutex;
+    pthread_cond_t behind_queued;   // Signalled when a buffer is handed over or the flusher should stop
+    pthread_cond_t behind_written;  // Signalled when a buffer was written and is free again
+
+    size_t readahead_depth;     // Read buffers to prefetch ahead of sequential reads, 0 for none
+    size_t readahead_streak;    // Reads in a row that continued where the previous one ended
+    size_t readahead_left;      // Bytes of the prefetched window still ahead of the file offset
 } buffered_file_t;
 
 // Function to wrap the original open function
 buffered_file_t *buffered_open(const char *pathname, int flags, ...);
 
+// Function to open with per-file buffer sizes; mode is used with O_CREAT, options may be NULL
+buffered_file_t *buffered_open_ex(const char *pathname, int flags, mode_t mode, const buffered_options_t *options);
+
 // Function to write to the buffered file
 ssize_t buffered_write(buffered_file_t *bf, const void *buf, size_t count);
 
 // Function to read from the buffered file
 ssize_t buffered_read(buffered_file_t *bf, void *buf, size_t count);
 
+// Function to get the next unread bytes without copying them: *data points into the mapping or the read buffer,
+// *length is 0 at end of file. The bytes stay valid until the next call on bf and are not consumed.
+int buffered_peek(buffered_file_t *bf, const void **data, size_t *length);
+
+// Function to consume count bytes of those returned by buffered_peek
+void buffered_consume(buffered_file_t *bf, size_t count);
+
+// Function to write the iovcnt pieces of iov as one record, buffered together or passed to writev when large.
+// With O_PREAPPEND the pieces go through the buffer like consecutive buffered_write calls.
+ssize_t buffered_writev(buffered_file_t *bf, const struct iovec *iov, int iovcnt);
+
+// Function to read into the iovcnt pieces of iov in order, passed to readv when large
+ssize_t buffered_readv(buffered_file_t *bf, const struct iovec *iov, int iovcnt);
+
 // Function to flush the buffer to the file
+// In write-behind mode it also waits until the flusher thread wrote every buffer handed to it.
+// With O_PREAPPEND the flushed data is only queued in a journal; every flush still lands in front of the
+// previous ones, and buffered_read already sees it there. The file is rewritten once, by buffered_compact
+// or buffered_close.
 int buffered_flush(buffered_file_t *bf);
 
+// Function to flush and write every queued prepend into the file in a single pass
+int buffered_compact(buffered_file_t *bf);
+
 // Function to close the buffered file
 int buffered_close(buffered_file_t *bf);
 
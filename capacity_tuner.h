@@ -0,0 +1,192 @@
+#ifndef CAPACITY_TUNER_H
+#define CAPACITY_TUNER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "finalfinal.h"
+
+// Background controller that resizes bounded buffers while the pipeline runs.
+//
+// Every interval it samples each buffer: a buffer whose inserters were blocked for a noticeable part of
+// the interval is doubled, a buffer that stayed mostly empty without blocking is halved back towards its
+// configured size. The sum of all capacities never exceeds the budget; when a blocked buffer cannot grow,
+// capacity is reclaimed from idle buffers first.
+class CapacityTuner
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    CapacityTuner(size_t budget, std::chrono::milliseconds interval = std::chrono::milliseconds(50))
+        : budget(budget), interval(interval), stopping(false) {}
+
+    ~CapacityTuner()
+    {
+        stop();
+    }
+
+    // Add a buffer to tune, its current capacity is the floor the tuner never shrinks below.
+    // Buffers can be added while the tuner runs; they must outlive it.
+    void track(BoundedBuffer& buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        BoundedBuffer::Sample sample = buffer.sample();
+        buffers.push_back({ &buffer, sample.capacity, sample.capacity, sample.blockedTime, 0 });
+    }
+
+    void setBudget(size_t slots)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = slots;
+    }
+
+    // Sum of the configured capacities, the smallest budget that makes sense
+    size_t baseline()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = 0;
+        for (const Tracked& tracked : buffers)
+        {
+            total += tracked.floor;
+        }
+        return total;
+    }
+
+    void start()
+    {
+        worker = std::thread([this] { run(); });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+private:
+    // A buffer grows when its inserters were blocked for more than 1/GROW_DIVISOR of the interval
+    enum { GROW_DIVISOR = 20 };
+    // Intervals a buffer must stay idle before it is shrunk
+    enum { IDLE_INTERVALS = 4 };
+
+    struct Tracked
+    {
+        BoundedBuffer* buffer;
+        size_t floor;
+        size_t capacity;
+        Clock::duration lastBlocked;
+        int idleIntervals;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wakeup.wait_for(lock, interval, [this] { return stopping; }))
+        {
+            tune();
+        }
+    }
+
+    void tune()
+    {
+        std::vector<size_t> starving;
+        size_t used = 0;
+
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            Tracked& tracked = buffers[i];
+            BoundedBuffer::Sample sample = tracked.buffer->sample();
+            Clock::duration blocked = sample.blockedTime - tracked.lastBlocked;
+            tracked.lastBlocked = sample.blockedTime;
+
+            if (blocked * GROW_DIVISOR > interval)
+            {
+                starving.push_back(i);
+                tracked.idleIntervals = 0;
+            }
+            else if (blocked == Clock::duration::zero() && sample.size < tracked.capacity / 4)
+            {
+                ++tracked.idleIntervals;
+            }
+            else
+            {
+                tracked.idleIntervals = 0;
+            }
+
+            if (tracked.idleIntervals >= IDLE_INTERVALS && tracked.capacity > tracked.floor)
+            {
+                resize(tracked, std::max(tracked.floor, tracked.capacity / 2));
+                tracked.idleIntervals = 0;
+            }
+            used += tracked.capacity;
+        }
+
+        for (size_t i : starving)
+        {
+            Tracked& tracked = buffers[i];
+            size_t wanted = tracked.capacity;
+            if (used < budget)
+            {
+                wanted = std::min(tracked.capacity * 2, tracked.capacity + (budget - used));
+            }
+            else
+            {
+                used -= reclaim(i, tracked.capacity);
+                if (used < budget)
+                {
+                    wanted = std::min(tracked.capacity * 2, tracked.capacity + (budget - used));
+                }
+            }
+            used += wanted - tracked.capacity;
+            resize(tracked, wanted);
+        }
+    }
+
+    // Shrink buffers that are not blocked back to their floor until amount slots are freed, return the freed slots
+    size_t reclaim(size_t except, size_t amount)
+    {
+        size_t freed = 0;
+        for (size_t i = 0; i < buffers.size() && freed < amount; ++i)
+        {
+            Tracked& tracked = buffers[i];
+            if (i == except || tracked.idleIntervals == 0 || tracked.capacity <= tracked.floor)
+            {
+                continue;
+            }
+            size_t take = std::min(tracked.capacity - tracked.floor, amount - freed);
+            resize(tracked, tracked.capacity - take);
+            freed += take;
+        }
+        return freed;
+    }
+
+    void resize(Tracked& tracked, size_t capacity)
+    {
+        if (capacity != tracked.capacity)
+        {
+            tracked.capacity = capacity;
+            tracked.buffer->setCapacity(capacity);
+        }
+    }
+
+    std::vector<Tracked> buffers;
+    size_t budget;
+    std::chrono::milliseconds interval;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef CONFIG_WATCHER_H
+#define CONFIG_WATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "finalfinal.h"
+#include "capacity_tuner.h"
+#include "pipeline_config.h"
+#include "pipeline_stats.h"
+
+// Owns the producer threads and their buffers. Buffers are kept until the supervisor is destroyed,
+// so the dispatcher, the tuner and the stats server can hold raw pointers to them even after a producer was retired.
+class ProducerSupervisor
+{
+public:
+    ProducerSupervisor(ProducerRegistry& registry, MessageRecorder* recorder = nullptr, CapacityTuner* tuner = nullptr,
+                       PipelineStats* stats = nullptr)
+        : registry(registry), recorder(recorder), tuner(tuner), stats(stats) {}
+
+    ~ProducerSupervisor()
+    {
+        joinAll();
+    }
+
+    // Create the buffer of a producer and run it in a new thread
+    void start(const ProducerConfig& config)
+    {
+        Entry& entry = create(config);
+        entry.thread = std::thread(Producer(config.id, config.numProducts, *entry.buffer, recorder, entry.stop.get(),
+                                            entry.stats));
+    }
+
+    // Create the buffer of a producer and replay recorded messages into it
+    void startReplay(const ProducerConfig& config, const std::vector<LoggedMessage>& messages,
+                     std::chrono::steady_clock::time_point start, bool paced)
+    {
+        Entry& entry = create(config);
+        entry.thread = std::thread(ReplayProducer(messages, *entry.buffer, start, paced, entry.stats));
+    }
+
+    // Ask a producer to stop; it closes its buffer and the dispatcher drains what is already queued
+    void retire(int id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = running.find(id);
+        if (found != running.end())
+        {
+            found->second->stop->store(true, std::memory_order_relaxed);
+            running.erase(found);
+        }
+    }
+
+    void joinAll()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : entries)
+        {
+            if (entry->thread.joinable())
+            {
+                entry->thread.join();
+            }
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<BoundedBuffer> buffer;
+        std::unique_ptr<std::atomic<bool>> stop;
+        ThreadStats* stats;
+        std::thread thread;
+    };
+
+    Entry& create(const ProducerConfig& config)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Entry> entry(new Entry);
+        entry->buffer.reset(new BoundedBuffer(config.queueSize));
+        entry->buffer->addProducer();
+        entry->stop.reset(new std::atomic<bool>(false));
+        entry->stats = nullptr;
+        if (tuner)
+        {
+            tuner->track(*entry->buffer);
+        }
+        if (stats)
+        {
+            std::string name = "producer " + std::to_string(config.id);
+            BoundedBuffer* buffer = entry->buffer.get();
+            entry->stats = &stats->addThread("producer", name);
+            stats->addQueue(name, [buffer] { return buffer->depth(); });
+        }
+        registry.add(entry->buffer.get());
+
+        Entry& created = *entry;
+        running[config.id] = &created;
+        entries.push_back(std::move(entry));
+        return created;
+    }
+
+    ProducerRegistry& registry;
+    MessageRecorder* recorder;
+    CapacityTuner* tuner;
+    PipelineStats* stats;
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::map<int, Entry*> running;
+    std::mutex mutex;
+};
+
+// Watches the config file with inotify and starts or retires producers when their PRODUCER sections
+// are added or removed. Other settings are only read at startup. The watcher ends, sealing the registry,
+// once every producer has finished and its buffer was drained.
+class ConfigWatcher
+{
+public:
+    ConfigWatcher(const std::string& path, const PipelineConfig& initial, const std::vector<std::string>& categories,
+                  ProducerSupervisor& supervisor, ProducerRegistry& registry)
+        : path(path), categories(categories), supervisor(supervisor), registry(registry)
+    {
+        for (const ProducerConfig& producer : initial.producers)
+        {
+            configured.insert(producer.id);
+        }
+    }
+
+    ~ConfigWatcher()
+    {
+        join();
+    }
+
+    void start()
+    {
+        worker = std::thread([this] { run(); });
+    }
+
+    void join()
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+private:
+    void run()
+    {
+        // Watch the directory, editors usually replace the file instead of writing it in place
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+        {
+            perror("Error watching config file");
+        }
+
+        alignas(struct inotify_event) char events[4096];
+        while (!registry.sealIfEmpty())
+        {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if (fd == -1 || poll(&pfd, 1, 100) <= 0)
+            {
+                if (fd == -1)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                continue;
+            }
+
+            bool changed = false;
+            ssize_t length;
+            while ((length = read(fd, events, sizeof(events))) > 0)
+            {
+                for (char* next = events; next < events + length; )
+                {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(next);
+                    if (event->len > 0 && name == event->name)
+                    {
+                        changed = true;
+                    }
+                    next += sizeof(struct inotify_event) + event->len;
+                }
+            }
+            if (changed)
+            {
+                reload();
+            }
+        }
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    void reload()
+    {
+        std::ifstream configFile(path);
+        PipelineConfig config;
+        std::string error;
+        if (!configFile || !parseConfig(configFile, categories, config, error))
+        {
+            std::cerr << "Ignoring config change: " << (configFile ? error : "cannot open " + path) << std::endl;
+            return;
+        }
+
+        std::set<int> next;
+        for (const ProducerConfig& producer : config.producers)
+        {
+            next.insert(producer.id);
+            if (!configured.count(producer.id))
+            {
+                supervisor.start(producer);
+            }
+        }
+        for (int id : configured)
+        {
+            if (!next.count(id))
+            {
+                supervisor.retire(id);
+            }
+        }
+        configured.swap(next);
+    }
+
+    std::string path;
+    std::vector<std::string> categories;
+    ProducerSupervisor& supervisor;
+    ProducerRegistry& registry;
+    std::set<int> configured;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef FAST_RANDOM_H
+#define FAST_RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// splitmix64, used to expand a small seed into well mixed generator state
+inline uint64_t splitmix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256** generator: a few shifts and multiplies per number, no allocation, no locking.
+// Usable with the <random> distributions, but below() is cheaper for small ranges.
+class Xoshiro256
+{
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed)
+    {
+        for (uint64_t& word : state)
+        {
+            word = splitmix64(seed);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()()
+    {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Number in [0, bound), by multiplying the high 32 bits instead of dividing
+    uint32_t below(uint32_t bound)
+    {
+        return static_cast<uint32_t>(((*this)() >> 32) * bound >> 32);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t state[4];
+};
+
+// Write the decimal digits of value to out, return the number of characters written (at most 20)
+inline size_t formatUnsigned(char* out, uint64_t value)
+{
+    char digits[20];
+    size_t length = 0;
+    do
+    {
+        digits[length++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    for (size_t i = 0; i < length; ++i)
+    {
+        out[i] = digits[length - 1 - i];
+    }
+    return length;
+}
+
+#endif
@@ -1,78 +1,231 @@
-#include "system.h"
+#include "finalfinal.h"
+#include "simulation.h"
+#include "capacity_tuner.h"
+#include "pipeline_config.h"
+#include "config_watcher.h"
+#include "stats_server.h"
 #include <fstream>
 #include <sstream>
 #include <vector>
 #include <thread>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 
 int main(int argc, char* argv[]) 
 {
-    // Check if the number of arguments is correct
-    if (argc != 2) 
+    // Parse the command line: the config file and the optional record / replay mode
+    const char* configPath = nullptr;
+    std::string recordPath;
+    std::string replayPath;
+    std::string statsSocket;
+    bool maxSpeed = false;
+    bool simulate = false;
+    bool laneStats = false;
+    bool autotune = false;
+    bool watch = false;
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Usage: " << argv[0] << " <config_file>" << std::endl;
+        std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--stats-socket" && i + 1 < argc)
+        {
+            statsSocket = argv[++i];
+        }
+        else if (arg == "--max-speed")
+        {
+            maxSpeed = true;
+        }
+        else if (arg == "--simulate")
+        {
+            simulate = true;
+        }
+        else if (arg == "--lane-stats")
+        {
+            laneStats = true;
+        }
+        else if (arg == "--autotune")
+        {
+            autotune = true;
+        }
+        else if (arg == "--watch")
+        {
+            watch = true;
+        }
+        else if (!configPath && arg[0] != '-')
+        {
+            configPath = argv[i];
+        }
+        else
+        {
+            configPath = nullptr;
+            break;
+        }
+    }
+    if (!configPath || (!recordPath.empty() + !replayPath.empty() + simulate) > 1 || (watch && (simulate || !replayPath.empty())))
+    {
+        std::cerr << "Usage: " << argv[0] << " <config_file> [--lane-stats] [--autotune] [--watch] [--stats-socket <path>] [--simulate | --record <log> | --replay <log> [--max-speed]]" << std::endl;
         return 1;
     }
 
     // Open the configuration file
-    std::ifstream configFile(argv[1]);
+    std::ifstream configFile(configPath);
     if (!configFile) 
     {
         std::cerr << "Error opening config file." << std::endl;
         return 1;
     }
 
-    // Vectors to hold producers, threads, and bounded buffers
-    std::vector<Producer> producerList;
-    std::vector<std::thread> producerThreads;
-    std::vector<BoundedBuffer*> producerBuffers;
-    int producerCount = 0;
-
-    std::string line;
-    // Read the configuration file line by line
-    while (std::getline(configFile, line))
+    // Open the message log for recording, or load the one to replay
+    std::unique_ptr<MessageRecorder> recorder;
+    std::map<int, std::vector<LoggedMessage>> replayLog;
+    try
     {
-        // Check for the "PRODUCER" keyword
-        if (line.find("PRODUCER") != std::string::npos) 
+        if (!recordPath.empty())
         {
-            int id = ++producerCount;
-            int productCount;
-            int bufferSize;
+            recorder.reset(new MessageRecorder(recordPath));
+        }
+        if (!replayPath.empty())
+        {
+            replayLog = loadMessageLog(replayPath);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 
-            // Read the number of products
-            std::getline(configFile, line);
-            std::istringstream(line) >> productCount;
-            
-            // Read the queue size
-            std::getline(configFile, line);
-            std::istringstream(line.substr(line.find("=") + 1)) >> bufferSize;
+    // Read the configuration
+    const std::vector<std::string> categories = { "SPORTS", "NEWS", "WEATHER" };
+    PipelineConfig config;
+    std::string error;
+    if (!parseConfig(configFile, categories, config, error))
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    size_t coEditorBufferSize = static_cast<size_t>(config.coEditorQueueSize);
 
-            // Create a bounded buffer for the producer
-            BoundedBuffer* buffer = new BoundedBuffer(bufferSize);
-            producerBuffers.push_back(buffer);
-            producerList.emplace_back(id, productCount, *buffer);
+    // Run the pipeline against a virtual clock instead of real threads
+    if (simulate)
+    {
+        std::vector<PipelineSimulator::ProducerSpec> producerSpecs;
+        for (const ProducerConfig& producer : config.producers)
+        {
+            producerSpecs.push_back({ producer.id, producer.numProducts, producer.queueSize });
         }
-    }
 
-    int coEditorBufferSize;
+        auto wallStart = std::chrono::steady_clock::now();
+        PipelineSimulator simulator(producerSpecs, coEditorBufferSize, CoEditor::editDuration());
+        PipelineSimulator::Report report = simulator.run();
+        auto wallTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wallStart);
 
-    // Read the queue size for the co-editors
-    std::getline(configFile, line);
-    std::getline(configFile, line);
-    std::istringstream(line.substr(line.find("=") + 1)) >> coEditorBufferSize;
+        auto ms = [](PipelineSimulator::Duration duration) { return duration.count() / 1000.0; };
+        std::cout << "Simulated time: " << ms(report.makespan) << " ms" << std::endl;
+        std::cout << "Messages: " << report.messages << std::endl;
+        std::cout << "Throughput: " << report.throughput << " msg/s" << std::endl;
+        std::cout << "Latency mean/p50/p99/max: " << ms(report.meanLatency) << " / " << ms(report.p50Latency) << " / "
+                  << ms(report.p99Latency) << " / " << ms(report.maxLatency) << " ms" << std::endl;
+        std::cout << "Producer blocked time: " << ms(report.producerBlocked) << " ms" << std::endl;
+        std::cout << "Wall time: " << wallTime.count() / 1000.0 << " ms" << std::endl;
+        return 0;
+    }
 
-    // Create bounded buffers for sports, news, weather, and co-editor
+    // Create bounded buffers for sports, news and weather, and one output lane per co-editor
     BoundedBuffer sportsBuffer(coEditorBufferSize);
     BoundedBuffer newsBuffer(coEditorBufferSize);
     BoundedBuffer weatherBuffer(coEditorBufferSize);
-    BoundedBuffer coEditorBuffer(coEditorBufferSize);
+    LaneScheduler coEditorLanes(categories, config.priorities, coEditorBufferSize, config.policy);
+
+    // Register the writer and the reader of each buffer and the writer of each lane; a buffer closes once its
+    // writers are done, and is abandoned once its readers are
+    sportsBuffer.addProducer();
+    newsBuffer.addProducer();
+    weatherBuffer.addProducer();
+    sportsBuffer.addConsumer();
+    newsBuffer.addConsumer();
+    weatherBuffer.addConsumer();
+    for (size_t lane = 0; lane < coEditorLanes.laneCount(); ++lane)
+    {
+        coEditorLanes.addProducer(lane);
+    }
+
+    // Let the tuner resize the producer and category buffers within the budget, by default four times the configured total
+    CapacityTuner tuner(config.queueBudget);
+    if (autotune)
+    {
+        tuner.track(sportsBuffer);
+        tuner.track(newsBuffer);
+        tuner.track(weatherBuffer);
+        if (config.queueBudget == 0)
+        {
+            size_t configured = tuner.baseline();
+            for (const ProducerConfig& producer : config.producers)
+            {
+                configured += producer.queueSize;
+            }
+            tuner.setBudget(4 * configured);
+        }
+        tuner.start();
+    }
+
+    // Counters of every stage, only collected when a stats socket was requested
+    PipelineStats pipelineStats;
+    PipelineStats* stats = statsSocket.empty() ? nullptr : &pipelineStats;
+    auto threadStats = [stats](const char* stage, const std::string& name)
+    {
+        return stats ? &stats->addThread(stage, name) : nullptr;
+    };
+    if (stats)
+    {
+        stats->addQueue("SPORTS", [&sportsBuffer] { return sportsBuffer.depth(); });
+        stats->addQueue("NEWS", [&newsBuffer] { return newsBuffer.depth(); });
+        stats->addQueue("WEATHER", [&weatherBuffer] { return weatherBuffer.depth(); });
+        for (size_t lane = 0; lane < coEditorLanes.laneCount(); ++lane)
+        {
+            const std::string& name = coEditorLanes.laneName(lane);
+            stats->addQueue("lane " + name, [&coEditorLanes, lane] { return coEditorLanes.depth(lane); });
+            stats->addLatency("lane " + name, coEditorLanes.waitTimes(lane));
+        }
+    }
+
+    // The producers and their buffers, and the registry the dispatcher reads them from
+    ProducerRegistry registry;
+    ProducerSupervisor supervisor(registry, recorder.get(), autotune ? &tuner : nullptr, stats);
+
+    // Serve the counters while the pipeline runs; declared after the supervisor so it stops before the producer buffers go away
+    std::unique_ptr<StatsServer> statsServer;
+    if (stats)
+    {
+        try
+        {
+            statsServer.reset(new StatsServer(statsSocket, pipelineStats));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        statsServer->start();
+    }
 
     // Initialize dispatcher and co-editors
-    Dispatcher dispatcher(producerBuffers, sportsBuffer, newsBuffer, weatherBuffer);
-    CoEditor sportsCoEditor(sportsBuffer, coEditorBuffer);
-    CoEditor newsCoEditor(newsBuffer, coEditorBuffer);
-    CoEditor weatherCoEditor(weatherBuffer, coEditorBuffer);
-    ScreenManager screenManager(coEditorBuffer);
+    RoutingTable routing(config.routes.empty() ? RoutingTable::byCategory(categories) : config.routes);
+    Dispatcher dispatcher(registry, routing, { &sportsBuffer, &newsBuffer, &weatherBuffer },
+                          threadStats("dispatcher", "dispatcher"));
+    CoEditor sportsCoEditor(sportsBuffer, coEditorLanes, 0, threadStats("co-editor", "co-editor SPORTS"));
+    CoEditor newsCoEditor(newsBuffer, coEditorLanes, 1, threadStats("co-editor", "co-editor NEWS"));
+    CoEditor weatherCoEditor(weatherBuffer, coEditorLanes, 2, threadStats("co-editor", "co-editor WEATHER"));
+    ScreenManager screenManager(coEditorLanes, threadStats("screen", "screen manager"));
 
     // Create threads for dispatcher, co-editors, and screen manager
     std::thread dispatcherThread(dispatcher);
@@ -81,17 +234,50 @@ int main(int argc, char* argv[])
     std::thread weatherCoEditorThread(weatherCoEditor);
     std::thread screenManagerThread(screenManager);
 
-    // Create threads for each producer
-    for (auto& producer : producerList) 
+    // Create threads for each producer, or replay the recorded messages into the producer queues
+    if (replayPath.empty())
+    {
+        for (const ProducerConfig& producer : config.producers)
+        {
+            supervisor.start(producer);
+        }
+    }
+    else
     {
-        producerThreads.emplace_back(producer);
+        static const std::vector<LoggedMessage> noMessages;
+        std::set<int> replayed;
+        auto start = std::chrono::steady_clock::now();
+        for (const ProducerConfig& producer : config.producers)
+        {
+            auto found = replayLog.find(producer.id);
+            const std::vector<LoggedMessage>& messages = found != replayLog.end() ? found->second : noMessages;
+            supervisor.startReplay(producer, messages, start, !maxSpeed);
+            replayed.insert(producer.id);
+        }
+        for (const auto& entry : replayLog)
+        {
+            if (!replayed.count(entry.first))
+            {
+                std::cerr << "Warning: log has messages of producer " << entry.first
+                          << " which is not in the config, skipping them." << std::endl;
+            }
+        }
     }
 
-    // Join all producer threads
-    for (auto& thread : producerThreads) 
+    // Without --watch the set of producers is final, otherwise the watcher seals it once every producer finished
+    ConfigWatcher watcher(configPath, config, categories, supervisor, registry);
+    if (watch)
     {
-        thread.join();
+        watcher.start();
     }
+    else
+    {
+        registry.seal();
+    }
+
+    // Join the watcher first, it is the only one starting producers, then all producer threads
+    watcher.join();
+    supervisor.joinAll();
 
     // Join dispatcher and co-editor threads
     dispatcherThread.join();
@@ -99,11 +285,15 @@ int main(int argc, char* argv[])
     newsCoEditorThread.join();
     weatherCoEditorThread.join();
     screenManagerThread.join();
+    tuner.stop();
+    if (statsServer)
+    {
+        statsServer->stop();
+    }
 
-    // Clean up dynamically allocated buffers
-    for (auto buffer : producerBuffers) 
+    if (laneStats)
     {
-        delete buffer;
+        coEditorLanes.report(std::cerr);
     }
 
     return 0;
@@ -2,6 +2,9 @@
 #define CONCURRENTSYSTEM_H
 
 #include <queue>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
@@ -9,51 +12,237 @@
 #include <string>
 #include <random>
 #include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <cstring>
+
+#include "fast_random.h"
+#include "message_log.h"
+#include "pipeline_stats.h"
+#include "routing.h"
+#include "batch_classifier.h"
+
+// Result of a non-blocking remove
+enum class RemoveStatus
+{
+    Item,       // An item was removed
+    Empty,      // Nothing to remove right now, but producers are still attached
+    Closed      // The buffer is closed and drained, nothing will ever arrive
+};
 
 class BoundedBuffer
 {
 public:
     using size_type = std::queue<std::string>::size_type;
 
-    BoundedBuffer(size_type amount) : maxAmount(amount) {}
+    BoundedBuffer(size_type amount) : maxAmount(amount), producers(0), consumers(0), closed(false), abandoned(false) {}
+
+    // Register a producer, the buffer closes itself when every registered producer is done
+    void addProducer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++producers;
+    }
+
+    // Called by a producer that will not insert anymore
+    void producerDone()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (producers > 0 && --producers == 0)
+        {
+            closed = true;
+            cond_var.notify_all();
+        }
+    }
+
+    // Register a consumer, the buffer is abandoned when every registered consumer is done
+    void addConsumer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++consumers;
+    }
+
+    // Called by a consumer that will not remove anymore. Once the last one left, what is queued is dropped
+    // and every insert returns false right away, so the producers can stop and leave their own inputs.
+    void consumerDone()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (consumers > 0 && --consumers == 0)
+        {
+            abandoned = true;
+            buffer = std::queue<std::string>();
+            count.store(0, std::memory_order_relaxed);
+            cond_var.notify_all();
+        }
+    }
+
+    // Close the buffer regardless of the attached producers, consumers still drain what is left
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        cond_var.notify_all();
+    }
 
-    // Insert new item to the buffer, if the buffer is full - wait when it will be place
-    void insert(const std::string& item)
+    // Insert new item to the buffer, if the buffer is full - wait when it will be place.
+    // Return false, dropping the item, once every consumer is done.
+    bool insert(const std::string& item)
     {
         std::unique_lock<std::mutex> lock(mutex);
-        cond_var.wait(lock, [this] { return buffer.size() < maxAmount; });
+        if (!waitForSpace(lock))
+        {
+            return false;
+        }
         buffer.push(item);
+        count.store(buffer.size(), std::memory_order_relaxed);
         cond_var.notify_all();
+        return true;
     }
 
-    // Remove item from the buffer and return it, if the buffer is empty, wait for item
-    std::string remove()
+    // Move several items in, in order, filling every free slot under one lock instead of locking per item.
+    // Return false once every consumer is done, the items not inserted yet are dropped.
+    bool insertBulk(std::string* items, size_t amount)
     {
         std::unique_lock<std::mutex> lock(mutex);
-        cond_var.wait(lock, [this] { return !buffer.empty(); });
-        std::string item = buffer.front();
-        buffer.pop();
-        cond_var.notify_all();
-        return item;
+        size_t inserted = 0;
+        while (inserted < amount)
+        {
+            if (!waitForSpace(lock))
+            {
+                return false;
+            }
+            while (inserted < amount && buffer.size() < maxAmount)
+            {
+                buffer.push(std::move(items[inserted++]));
+            }
+            count.store(buffer.size(), std::memory_order_relaxed);
+            cond_var.notify_all();
+        }
+        return true;
     }
 
-    // Check if we can remove from the buffer (not empty)
-    bool tryRemove(std::string& item)
+    // Remove item from the buffer, if the buffer is empty, wait for item.
+    // Return false once the buffer is closed and drained.
+    bool remove(std::string& item)
     {
         std::unique_lock<std::mutex> lock(mutex);
+        cond_var.wait(lock, [this] { return !buffer.empty() || closed; });
         if (buffer.empty())
         {
             return false;
         }
-        item = buffer.front();
+        item = std::move(buffer.front());
         buffer.pop();
+        count.store(buffer.size(), std::memory_order_relaxed);
         cond_var.notify_all();
         return true;
     }
 
+    // Remove an item if there is one, without waiting
+    RemoveStatus tryRemove(std::string& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (buffer.empty())
+        {
+            return closed ? RemoveStatus::Closed : RemoveStatus::Empty;
+        }
+        item = std::move(buffer.front());
+        buffer.pop();
+        count.store(buffer.size(), std::memory_order_relaxed);
+        cond_var.notify_all();
+        return RemoveStatus::Item;
+    }
+
+    // Remove up to most items without waiting, set removed to how many were taken
+    RemoveStatus tryRemoveBulk(std::string* items, size_t most, size_t& removed)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        removed = 0;
+        if (buffer.empty())
+        {
+            return closed ? RemoveStatus::Closed : RemoveStatus::Empty;
+        }
+        while (removed < most && !buffer.empty())
+        {
+            items[removed++].swap(buffer.front());
+            buffer.pop();
+        }
+        count.store(buffer.size(), std::memory_order_relaxed);
+        cond_var.notify_all();
+        return RemoveStatus::Item;
+    }
+
+    // Change the capacity online; inserters blocked on a full buffer wake up if it grew.
+    // Shrinking below the current size only stops inserts until consumers catch up.
+    void setCapacity(size_type amount)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxAmount = amount > 0 ? amount : 1;
+        cond_var.notify_all();
+    }
+
+    // Number of queued items, readable without taking the lock
+    size_type depth() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // Snapshot of the buffer load, used by the capacity tuner
+    struct Sample
+    {
+        size_type size;
+        size_type capacity;
+        std::chrono::steady_clock::duration blockedTime;   // Total time inserters waited, since construction,
+                                                            // waits still in progress included
+    };
+
+    Sample sample()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::chrono::steady_clock::duration blocked = blockedTime;
+        if (blockedWaiters > 0)
+        {
+            // An inserter blocked for the whole interval counts too, not only once it got through
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            blocked += now * static_cast<std::chrono::steady_clock::rep>(blockedWaiters) - blockedSince;
+        }
+        return { buffer.size(), maxAmount, blocked };
+    }
+
 private:
+    // Wait until there is room, return false if every consumer is done instead
+    bool waitForSpace(std::unique_lock<std::mutex>& lock)
+    {
+        if (buffer.size() >= maxAmount && !abandoned)
+        {
+            // Only a blocked insert pays for reading the clock
+            auto blockedFrom = std::chrono::steady_clock::now();
+            ++blockedWaiters;
+            blockedSince += blockedFrom.time_since_epoch();
+            cond_var.wait(lock, [this] { return buffer.size() < maxAmount || abandoned; });
+            --blockedWaiters;
+            blockedSince -= blockedFrom.time_since_epoch();
+            blockedTime += std::chrono::steady_clock::now() - blockedFrom;
+        }
+        if (closed)
+        {
+            throw std::logic_error("insert into a closed BoundedBuffer");
+        }
+        return !abandoned;
+    }
+
     std::queue<std::string> buffer;
     size_type maxAmount;
+    size_t producers;
+    size_t consumers;
+    bool closed;
+    bool abandoned;
+    std::chrono::steady_clock::duration blockedTime{ 0 };
+    size_t blockedWaiters = 0;                                  // Inserters waiting right now
+    std::chrono::steady_clock::duration blockedSince{ 0 };      // Sum of the times they started waiting
+    std::atomic<size_type> count{ 0 };
     std::mutex mutex;
     std::condition_variable cond_var;
 };
@@ -61,146 +250,545 @@ private:
 class Producer
 {
 public:
-    Producer(int id, int numProducts, BoundedBuffer& queue)
-        : id(id), numProducts(numProducts), queue(queue) {}
+    // Messages generated per batch, inserted into the queue with a single lock
+    enum { BATCH = 32 };
+
+    // A producer stops early, still closing its queue, once stop is set
+    Producer(int id, int numProducts, BoundedBuffer& queue, MessageRecorder* recorder = nullptr,
+             const std::atomic<bool>* stop = nullptr, ThreadStats* stats = nullptr)
+        : id(id), numProducts(numProducts), queue(queue), recorder(recorder), stop(stop), stats(stats) {}
+
+    // Seed of the category generator, so every producer draws its own sequence
+    static uint64_t seed(int id) { return static_cast<uint64_t>(id); }
 
     void operator()()
     {
-        std::vector<std::string> categories = { "SPORTS", "NEWS", "WEATHER" };
-        std::default_random_engine rander;
-        std::uniform_int_distribution<int> numbers(0, 2);
+        static const char* const categories[] = { "SPORTS", "NEWS", "WEATHER" };
+        static const size_t lengths[] = { 6, 4, 7 };
+        Xoshiro256 rander(seed(id));
 
-        for (int i = 0; i < numProducts; ++i)
-        {
-            std::string category = categories[numbers(rander)];
-            std::string message;
+        // "Producer <id> " never changes, each message only writes its category and counter after it
+        char text[64];
+        std::string prefix = "Producer " + std::to_string(id) + " ";
+        memcpy(text, prefix.data(), prefix.size());
+
+        // Messages are longer than the inline storage of a std::string, so each one allocates once, when it is
+        // assigned; the queue then takes that string over without copying it
+        std::vector<std::string> batch(BATCH);
 
-            if (category == "SPORTS")
+        for (int produced = 0; produced < numProducts; )
+        {
+            if (stop && stop->load(std::memory_order_relaxed))
             {
-                message = "Producer " + std::to_string(id) + " " + category + " " + std::to_string(category_Counter.sport);
-                category_Counter.sport++;
+                break;
             }
-            else if (category == "NEWS")
+            markState(stats, ThreadState::Working);
+            size_t amount = static_cast<size_t>(numProducts - produced < BATCH ? numProducts - produced : BATCH);
+            for (size_t i = 0; i < amount; ++i)
             {
-                message = "Producer " + std::to_string(id) + " " + category + " " + std::to_string(category_Counter.news);
-                category_Counter.news++;
+                uint32_t category = rander.below(3);
+                char* out = text + prefix.size();
+                memcpy(out, categories[category], lengths[category]);
+                out += lengths[category];
+                *out++ = ' ';
+                out += formatUnsigned(out, category_Counter[category]++);
+                batch[i].assign(text, out - text);
+                if (recorder)
+                {
+                    recorder->record(id, batch[i]);
+                }
             }
-            else if (category == "WEATHER")
+            markState(stats, ThreadState::WaitingOutput);
+            if (!queue.insertBulk(batch.data(), amount))
             {
-                message = "Producer " + std::to_string(id) + " " + category + " " + std::to_string(category_Counter.weather);
-                category_Counter.weather++;
+                break;  // Nobody reads the queue anymore
             }
-            queue.insert(message);
+            countMessage(stats, amount);
+            produced += static_cast<int>(amount);
         }
-        queue.insert("DONE");
+        queue.producerDone();
+        markState(stats, ThreadState::Finished);
     }
 
 private:
-    struct Category_Counter
-    {
-        int sport = 0;
-        int news = 0;
-        int weather = 0;
-    } category_Counter;
+    // Next number of each category: SPORTS, NEWS, WEATHER
+    uint64_t category_Counter[3] = {};
 
     int id;
     int numProducts;
     BoundedBuffer& queue;
+    MessageRecorder* recorder;
+    const std::atomic<bool>* stop;
+    ThreadStats* stats;
+};
+
+// Replays the recorded messages of one producer into its queue, at the recorded pace or as fast as possible
+class ReplayProducer
+{
+public:
+    ReplayProducer(const std::vector<LoggedMessage>& messages, BoundedBuffer& queue,
+                   std::chrono::steady_clock::time_point start, bool paced, ThreadStats* stats = nullptr)
+        : messages(messages), queue(queue), start(start), paced(paced), stats(stats) {}
+
+    void operator()()
+    {
+        for (const LoggedMessage& message : messages)
+        {
+            if (paced)
+            {
+                markState(stats, ThreadState::Working);
+                std::this_thread::sleep_until(start + message.offset);
+            }
+            markState(stats, ThreadState::WaitingOutput);
+            if (!queue.insert(message.text))
+            {
+                break;
+            }
+            countMessage(stats);
+        }
+        queue.producerDone();
+        markState(stats, ThreadState::Finished);
+    }
+
+private:
+    const std::vector<LoggedMessage>& messages;
+    BoundedBuffer& queue;
+    std::chrono::steady_clock::time_point start;
+    bool paced;
+    ThreadStats* stats;
 };
 
+// The producer buffers the dispatcher reads from. Buffers can be added and retired while the pipeline runs;
+// the dispatcher only takes the lock to refresh its snapshot when the version changed.
+// Once sealed no buffer is added anymore, and the dispatcher ends when the last one is retired.
+class ProducerRegistry
+{
+public:
+    ProducerRegistry() : currentVersion(0), sealed(false) {}
+
+    // The dispatcher reading the registry is registered as the consumer of the buffer
+    void add(BoundedBuffer* buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (sealed)
+        {
+            throw std::logic_error("add to a sealed ProducerRegistry");
+        }
+        buffer->addConsumer();
+        buffers.push_back(buffer);
+        currentVersion.fetch_add(1, std::memory_order_release);
+        cond_var.notify_all();
+    }
+
+    // Remove a closed and drained buffer
+    void retire(BoundedBuffer* buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer), buffers.end());
+        currentVersion.fetch_add(1, std::memory_order_release);
+        cond_var.notify_all();
+    }
+
+    // No more buffers will be added
+    void seal()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sealed = true;
+        currentVersion.fetch_add(1, std::memory_order_release);
+        cond_var.notify_all();
+    }
+
+    // Seal only if every buffer has been retired, return whether the registry is sealed
+    bool sealIfEmpty()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (buffers.empty() && !sealed)
+        {
+            sealed = true;
+            currentVersion.fetch_add(1, std::memory_order_release);
+            cond_var.notify_all();
+        }
+        return sealed;
+    }
+
+    uint64_t version() const
+    {
+        return currentVersion.load(std::memory_order_acquire);
+    }
+
+    // Sleep until a buffer is added or retired or the registry is sealed, after version seen
+    void waitForChange(uint64_t seen)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond_var.wait(lock, [&] { return currentVersion.load(std::memory_order_relaxed) != seen; });
+    }
+
+    // Copy the current buffers, return whether the registry is sealed
+    bool snapshot(std::vector<BoundedBuffer*>& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out = buffers;
+        return sealed;
+    }
+
+private:
+    std::vector<BoundedBuffer*> buffers;
+    std::atomic<uint64_t> currentVersion;
+    bool sealed;
+    std::mutex mutex;
+    std::condition_variable cond_var;
+};
+
+// Moves messages from the producer buffers to the output buffers the routing table selects, fanning out
+// a message that matches several rules. Messages are taken and classified a batch at a time.
+// Must be registered as a producer of each output buffer; releases them when the registry is sealed and
+// every producer buffer was closed and drained.
+// Once every output lost its consumers, the dispatcher leaves each producer buffer instead of reading it.
 class Dispatcher
 {
 public:
-    Dispatcher(std::vector<BoundedBuffer*>& producer_buffers, BoundedBuffer& sports_buffer, BoundedBuffer& news_buffer, BoundedBuffer& weather_buffer)
-        : producer_buffers(producer_buffers), sports_buffer(sports_buffer), news_buffer(news_buffer), weather_buffer(weather_buffer), doneCount(0) {}
+    Dispatcher(ProducerRegistry& registry, const RoutingTable& routing, std::vector<BoundedBuffer*> outputs,
+               ThreadStats* stats = nullptr)
+        : registry(registry), routing(routing), outputs(std::move(outputs)), stats(stats)
+    {
+        if (this->outputs.size() > RoutingTable::MAX_OUTPUTS)
+        {
+            throw std::invalid_argument("too many dispatcher outputs");
+        }
+    }
 
     void operator()() {
-        size_t producers_number = producer_buffers.size();
+        BatchClassifier classifier(routing);
+        std::vector<std::string> batch(BatchClassifier::MAX_BATCH);
+        RoutingTable::Mask masks[BatchClassifier::MAX_BATCH];
+        std::vector<BoundedBuffer*> producer_buffers;
+        uint64_t seenVersion = registry.version() - 1;
+        bool sealed = false;
+        // Outputs that still have consumers
+        RoutingTable::Mask openOutputs = outputs.size() < 64 ? (RoutingTable::Mask(1) << outputs.size()) - 1 : ~RoutingTable::Mask(0);
         size_t index = 0;
-        while (doneCount < producers_number)
+        markState(stats, ThreadState::WaitingInput);
+        while (true)
         {
-            std::string message;
-            if (producer_buffers[index]->tryRemove(message))
+            uint64_t version = registry.version();
+            if (version != seenVersion)
+            {
+                sealed = registry.snapshot(producer_buffers);
+                seenVersion = version;
+                index = 0;
+            }
+            if (producer_buffers.empty())
             {
-                if (message == "DONE")
+                if (sealed)
                 {
-                    ++doneCount;
+                    break;
                 }
-                else
+                registry.waitForChange(seenVersion);
+                continue;
+            }
+
+            if (openOutputs == 0)
+            {
+                // Nothing would be delivered, let the producers see their buffer abandoned and stop
+                producer_buffers[index]->consumerDone();
+                registry.retire(producer_buffers[index]);
+                index = (index + 1) % producer_buffers.size();
+                continue;
+            }
+
+            size_t removed;
+            RemoveStatus status = producer_buffers[index]->tryRemoveBulk(batch.data(), batch.size(), removed);
+            if (status == RemoveStatus::Closed)
+            {
+                registry.retire(producer_buffers[index]);
+            }
+            else if (status == RemoveStatus::Item)
+            {
+                markState(stats, ThreadState::WaitingOutput);
+                classifier.classify(batch.data(), removed, masks);
+                for (size_t i = 0; i < removed; ++i)
                 {
-                    if (message.find("SPORTS") != std::string::npos) {
-                        sports_buffer.insert(message);
+                    // Messages no rule matches are dropped
+                    for (RoutingTable::Mask mask = masks[i] & openOutputs; mask != 0; mask &= mask - 1)
+                    {
+                        size_t output = static_cast<size_t>(__builtin_ctzll(mask));
+                        if (!outputs[output]->insert(batch[i]))
+                        {
+                            openOutputs &= ~(RoutingTable::Mask(1) << output);
+                        }
                     }
-                    else if (message.find("NEWS") != std::string::npos) {
-                        news_buffer.insert(message);
-                    }
-                    else if (message.find("WEATHER") != std::string::npos) {
-                        weather_buffer.insert(message);
+                }
+                countMessage(stats, removed);
+                markState(stats, ThreadState::WaitingInput);
+            }
+            index = (index + 1) % producer_buffers.size();
+        }
+        for (BoundedBuffer* output : outputs)
+        {
+            output->producerDone();
+        }
+        markState(stats, ThreadState::Finished);
+    }
+
+private:
+    ProducerRegistry& registry;
+    const RoutingTable& routing;
+    std::vector<BoundedBuffer*> outputs;
+    ThreadStats* stats;
+};
+
+// How the screen manager picks the next lane to display from
+enum class SchedulingPolicy
+{
+    Strict,     // Always the highest priority lane that has a message
+    Weighted    // Smooth weighted round robin, each lane gets a share proportional to its priority
+};
+
+// Chooses a lane among the non-empty ones according to the policy.
+// A lane that was passed over starvationLimit times in a row while it had messages is served next.
+class LaneSelector
+{
+public:
+    LaneSelector(std::vector<int> priorities, SchedulingPolicy policy, int starvationLimit)
+        : priorities(std::move(priorities)), policy(policy), starvationLimit(starvationLimit),
+          credit(this->priorities.size(), 0), skipped(this->priorities.size(), 0) {}
+
+    // Return the lane to serve, or -1 when every lane is empty
+    int pick(const std::vector<bool>& ready)
+    {
+        int chosen = -1;
+        for (size_t lane = 0; lane < ready.size(); ++lane)
+        {
+            if (ready[lane] && skipped[lane] >= starvationLimit)
+            {
+                chosen = static_cast<int>(lane);
+                break;
+            }
+        }
+
+        if (chosen < 0 && policy == SchedulingPolicy::Strict)
+        {
+            for (size_t lane = 0; lane < ready.size(); ++lane)
+            {
+                if (ready[lane] && (chosen < 0 || priorities[lane] > priorities[chosen]))
+                {
+                    chosen = static_cast<int>(lane);
+                }
+            }
+        }
+        else if (chosen < 0)
+        {
+            int total = 0;
+            for (size_t lane = 0; lane < ready.size(); ++lane)
+            {
+                if (ready[lane])
+                {
+                    credit[lane] += priorities[lane];
+                    total += priorities[lane];
+                    if (chosen < 0 || credit[lane] > credit[chosen])
+                    {
+                        chosen = static_cast<int>(lane);
                     }
                 }
             }
-            index = (index + 1) % producers_number;
+            if (chosen >= 0)
+            {
+                credit[chosen] -= total;
+            }
+        }
+
+        if (chosen >= 0)
+        {
+            for (size_t lane = 0; lane < ready.size(); ++lane)
+            {
+                skipped[lane] = (ready[lane] && static_cast<int>(lane) != chosen) ? skipped[lane] + 1 : 0;
+            }
         }
-        sports_buffer.insert("DONE");
-        news_buffer.insert("DONE");
-        weather_buffer.insert("DONE");
+        return chosen;
     }
 
 private:
-    std::vector<BoundedBuffer*>& producer_buffers;
-    BoundedBuffer& sports_buffer;
-    BoundedBuffer& news_buffer;
-    BoundedBuffer& weather_buffer;
-    size_t doneCount;
+    std::vector<int> priorities;
+    SchedulingPolicy policy;
+    int starvationLimit;
+    std::vector<int> credit;
+    std::vector<int> skipped;
 };
 
-class CoEditor {
+// One bounded lane per co-editor, consumed by the screen manager through a LaneSelector.
+// Keeps per-lane statistics of how long messages waited in the lane.
+class LaneScheduler
+{
 public:
-    CoEditor(BoundedBuffer& input_buffer, BoundedBuffer& output_buffer)
-        : input_buffer(input_buffer), output_buffer(output_buffer) {}
-    void operator()()
+    using Clock = std::chrono::steady_clock;
+
+    LaneScheduler(std::vector<std::string> names, std::vector<int> priorities, size_t laneSize,
+                  SchedulingPolicy policy, int starvationLimit = 32)
+        : names(std::move(names)), lanes(this->names.size()), writers(this->names.size(), 0),
+          closed(this->names.size(), false), openLanes(this->names.size()), stats(this->names.size()),
+          depths(new std::atomic<size_t>[this->names.size()]()), laneSize(laneSize),
+          selector(std::move(priorities), policy, starvationLimit) {}
+
+    size_t laneCount() const { return lanes.size(); }
+
+    const std::string& laneName(size_t lane) const { return names[lane]; }
+
+    // Number of queued messages in a lane, readable without taking the lock
+    size_t depth(size_t lane) const { return depths[lane].load(std::memory_order_relaxed); }
+
+    // How long messages waited in a lane, readable without taking the lock
+    const LatencyHistogram& waitTimes(size_t lane) const { return stats[lane]; }
+
+    // Register a writer of a lane, the lane closes when every registered writer is done
+    void addProducer(size_t lane)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++writers[lane];
+    }
+
+    // Called by a lane writer that will not insert anymore
+    void producerDone(size_t lane)
     {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (writers[lane] > 0 && --writers[lane] == 0 && !closed[lane])
+        {
+            closed[lane] = true;
+            --openLanes;
+            notEmpty.notify_all();
+        }
+    }
+
+    // Insert a message to a lane, if the lane is full - wait until it has place
+    void insert(size_t lane, const std::string& message)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return lanes[lane].size() < laneSize; });
+        lanes[lane].push_back({ message, Clock::now() });
+        depths[lane].store(lanes[lane].size(), std::memory_order_relaxed);
+        notEmpty.notify_one();
+    }
+
+    // Remove the next message according to the scheduling policy, wait if every lane is empty.
+    // Return false once every lane is closed and drained.
+    bool remove(std::string& message)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::vector<bool> ready(lanes.size());
+        int lane;
         while (true)
         {
-            std::string message = input_buffer.remove();
-            if (message == "DONE")
+            for (size_t i = 0; i < lanes.size(); ++i)
+            {
+                ready[i] = !lanes[i].empty();
+            }
+            lane = selector.pick(ready);
+            if (lane >= 0)
             {
-                output_buffer.insert("DONE");
                 break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            output_buffer.insert(message);
+            if (openLanes == 0)
+            {
+                return false;
+            }
+            notEmpty.wait(lock);
+        }
+
+        Entry& entry = lanes[lane].front();
+        stats[lane].add(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - entry.enqueued));
+        message = std::move(entry.message);
+        lanes[lane].pop_front();
+        depths[lane].store(lanes[lane].size(), std::memory_order_relaxed);
+        notFull.notify_all();
+        return true;
+    }
+
+    // Print count, mean, p50, p99 and max wait per lane
+    void report(std::ostream& out)
+    {
+        for (size_t lane = 0; lane < lanes.size(); ++lane)
+        {
+            const LatencyHistogram& lane_stats = stats[lane];
+            out << names[lane] << ": " << lane_stats.samples() << " messages, wait mean "
+                << lane_stats.mean() << " us, p50 <= " << lane_stats.percentile(0.50) << " us, p99 <= "
+                << lane_stats.percentile(0.99) << " us, max " << lane_stats.maximum() << " us" << std::endl;
         }
     }
+
+private:
+    struct Entry
+    {
+        std::string message;
+        Clock::time_point enqueued;
+    };
+
+    std::vector<std::string> names;
+    std::vector<std::deque<Entry>> lanes;
+    std::vector<size_t> writers;
+    std::vector<bool> closed;
+    size_t openLanes;
+    std::vector<LatencyHistogram> stats;
+    std::unique_ptr<std::atomic<size_t>[]> depths;
+    size_t laneSize;
+    LaneSelector selector;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+class CoEditor {
+public:
+    CoEditor(BoundedBuffer& input_buffer, LaneScheduler& output, size_t lane, ThreadStats* stats = nullptr)
+        : input_buffer(input_buffer), output(output), lane(lane), stats(stats) {}
+
+    // Time spent editing each message
+    static std::chrono::milliseconds editDuration() { return std::chrono::milliseconds(100); }
+
+    void operator()()
+    {
+        std::string message;
+        markState(stats, ThreadState::WaitingInput);
+        while (input_buffer.remove(message))
+        {
+            markState(stats, ThreadState::Working);
+            std::this_thread::sleep_for(editDuration());
+            markState(stats, ThreadState::WaitingOutput);
+            output.insert(lane, message);
+            countMessage(stats);
+            markState(stats, ThreadState::WaitingInput);
+        }
+        input_buffer.consumerDone();
+        output.producerDone(lane);
+        markState(stats, ThreadState::Finished);
+    }
 private:
     BoundedBuffer& input_buffer;
-    BoundedBuffer& output_buffer;
+    LaneScheduler& output;
+    size_t lane;
+    ThreadStats* stats;
 };
 
 class ScreenManager
 {
 public:
-    ScreenManager(BoundedBuffer& buffer) : buffer(buffer), counter(0) {}
+    ScreenManager(LaneScheduler& lanes, ThreadStats* stats = nullptr) : lanes(lanes), stats(stats) {}
     void operator()()
     {
-        while (counter < 3)
+        std::string message;
+        markState(stats, ThreadState::WaitingInput);
+        while (lanes.remove(message))
         {
-            std::string message = buffer.remove();
-            if (message == "DONE")
-            {
-                ++counter;
-            }
-            else
-            {
-                std::cout << message << std::endl;
-            }
+            markState(stats, ThreadState::Working);
+            std::cout << message << std::endl;
+            countMessage(stats);
+            markState(stats, ThreadState::WaitingInput);
         }
         std::cout << "DONE" << std::endl;
+        markState(stats, ThreadState::Finished);
     }
 
 private:
-    BoundedBuffer& buffer;
-    size_t counter;
+    LaneScheduler& lanes;
+    ThreadStats* stats;
 };
 
 #endif
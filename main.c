@@ -2,32 +2,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include "async_log.h"
+#include "bounded_buffer.h"
 
 #define MAX_STRING_LENGTH 100
 #define NUM_TYPES 3
 
-typedef struct {
-    char **buffer;
-    int size;
-    int in;
-    int out;
-    sem_t full;
-    sem_t empty;
-    pthread_mutex_t mutex;
-} BoundedBuffer;
+#define MAX_LINE_LENGTH 256
 
 typedef struct {
     int id;
     int num_products;
+    int queue_size;
     BoundedBuffer *queue;
 } ProducerArgs;
 
+// Producer tasks are run by a fixed number of pool threads, each taking the next task that has not started
+typedef struct {
+    ProducerArgs *producers;
+    int num_producers;
+    atomic_int next;
+} ProducerPool;
+
 typedef struct {
-    BoundedBuffer *producer_queues;
-    BoundedBuffer *dispatcher_queues;
+    BoundedBuffer **producer_queues;
+    BoundedBuffer **dispatcher_queues;
     int num_producers;
+    BufferSignal *data_available;   // Attached to every producer queue
 } DispatcherArgs;
 
 typedef struct {
@@ -40,202 +43,89 @@ typedef struct {
     BoundedBuffer *shared_queue;
 } ScreenManagerArgs;
 
-BoundedBuffer *create_bounded_buffer(int size);
-void insert_bounded_buffer(BoundedBuffer *bb, const char *str);
-char *remove_bounded_buffer(BoundedBuffer *bb);
-void destroy_bounded_buffer(BoundedBuffer *bb);
-
-void *producer_thread(void *args);
+void *producer_pool_thread(void *args);
 void *dispatcher_thread(void *args);
 void *co_editor_thread(void *args);
 void *screen_manager_thread(void *args);
 
-BoundedBuffer *create_bounded_buffer(int size) {
-    BoundedBuffer *bb = (BoundedBuffer *)malloc(sizeof(BoundedBuffer));
-    if (bb == NULL) {
-        printf("Error allocating BoundedBuffer\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    bb->buffer = (char **)malloc(size * sizeof(char *));
-    if (bb->buffer == NULL) {
-        printf("Error allocating buffer in BoundedBuffer\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    for (int i = 0; i < size; i++) {
-        bb->buffer[i] = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
-        if (bb->buffer[i] == NULL) {
-            printf("Error allocating buffer element in BoundedBuffer\n");
-            perror("Reason");
-            exit(EXIT_FAILURE);
+static void run_producer(ProducerArgs *p_args) {
+    const char *types[] = {"SPORTS", "NEWS", "WEATHER"};
+    unsigned int seed = (unsigned int)p_args->id; // Own generator state, rand() would serialize the pool threads
+    for (int i = 0; i < p_args->num_products; i++) {
+        int type_idx = rand_r(&seed) % NUM_TYPES;
+        // Format straight into the queue slot
+        char *product = reserve_bounded_buffer(p_args->queue);
+        if (product == NULL) {
+            perror("Error reserving product");
+            continue;
         }
+        snprintf(product, BOUNDED_BUFFER_MAX_STRING, "Producer %d %s %d", p_args->id, types[type_idx], i);
+        ASYNC_LOG(LOG_LEVEL_DEBUG, "Producer %d produced %s\n", p_args->id, product);
+        commit_bounded_buffer(p_args->queue);
     }
-    
-    bb->size = size;
-    bb->in = 0;
-    bb->out = 0;
-    
-    if (sem_init(&bb->full, 0, 0) != 0) {
-        printf("Error initializing full semaphore in BoundedBuffer\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_init(&bb->empty, 0, size) != 0) {
-        printf("Error initializing empty semaphore in BoundedBuffer\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_init(&bb->mutex, NULL) != 0) {
-        printf("Error initializing mutex in BoundedBuffer\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    return bb;
-}
-
-void insert_bounded_buffer(BoundedBuffer *bb, const char *str) {
-    // Check if the mutex has been initialized
-    if (pthread_mutex_lock(&bb->mutex) != 0) {
-        printf("Error locking mutex\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    strncpy(bb->buffer[bb->in], str, MAX_STRING_LENGTH);
-    bb->in = (bb->in + 1) % bb->size;
-
-    // Unlock the mutex only if it was successfully locked
-    if (pthread_mutex_unlock(&bb->mutex) != 0) {
-        printf("Error unlocking mutex\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    if (sem_wait(&bb->empty) != 0) {
-        printf("Error waiting on empty semaphore\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    if (sem_post(&bb->full) != 0) {
-        printf("Error posting to full semaphore\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-}
-
-
-char *remove_bounded_buffer(BoundedBuffer *bb) {
-    // Check if the mutex has been initialized
-    if (pthread_mutex_lock(&bb->mutex) != 0) {
-        printf("Error locking mutex\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    char *str = strdup(bb->buffer[bb->out]); // Make a copy of the string to return
-    bb->out = (bb->out + 1) % bb->size;
-
-    // Unlock the mutex only if it was successfully locked
-    if (pthread_mutex_unlock(&bb->mutex) != 0) {
-        printf("Error unlocking mutex\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    if (sem_wait(&bb->full) != 0) {
-        printf("Error waiting on full semaphore\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    if (sem_post(&bb->empty) != 0) {
-        printf("Error posting to empty semaphore\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-
-    return str;
+    insert_bounded_buffer(p_args->queue, "DONE");
+    ASYNC_LOG(LOG_LEVEL_INFO, "Producer %d done\n", p_args->id);
 }
 
-
-void destroy_bounded_buffer(BoundedBuffer *bb) {
-    for (int i = 0; i < bb->size; i++) {
-        free(bb->buffer[i]);
+void *producer_pool_thread(void *args) {
+    ProducerPool *pool = (ProducerPool *)args;
+    int task;
+    while ((task = atomic_fetch_add(&pool->next, 1)) < pool->num_producers) {
+        run_producer(&pool->producers[task]);
     }
-    free(bb->buffer);
-    
-    if (sem_destroy(&bb->full) != 0) {
-        printf("Error destroying full semaphore\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_destroy(&bb->empty) != 0) {
-        printf("Error destroying empty semaphore\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_destroy(&bb->mutex) != 0) {
-        printf("Error destroying mutex\n");
-        perror("Reason");
-        exit(EXIT_FAILURE);
-    }
-    
-    free(bb);
+    return NULL;
 }
 
-void *producer_thread(void *args) {
-    ProducerArgs *p_args = (ProducerArgs *)args;
-    const char *types[] = {"SPORTS", "NEWS", "WEATHER"};
-    for (int i = 0; i < p_args->num_products; i++) {
-        int type_idx = rand() % NUM_TYPES;
-        char product[MAX_STRING_LENGTH];
-        snprintf(product, MAX_STRING_LENGTH, "Producer %d %s %d", p_args->id, types[type_idx], i);
-        insert_bounded_buffer(p_args->queue, product);
-        printf("Producer %d produced %s\n", p_args->id, product);
+// Copy a string that is read in place into the next queue; the only copy a message makes between stages
+static void forward(BoundedBuffer *queue, const char *message, size_t length) {
+    char *slot = reserve_bounded_buffer_length(queue, length + 1);
+    if (slot == NULL) {
+        perror("Error forwarding message");
+        return;
     }
-    insert_bounded_buffer(p_args->queue, "DONE");
-    printf("Producer %d done\n", p_args->id);
-    return NULL;
+    memcpy(slot, message, length + 1);
+    commit_bounded_buffer(queue);
 }
 
 void *dispatcher_thread(void *args) {
     DispatcherArgs *d_args = (DispatcherArgs *)args;
     int num_done = 0;
     while (num_done < d_args->num_producers) {
+        // Read the sequence before draining, so a message that arrives during the pass ends the wait right away
+        unsigned seen = read_buffer_signal(d_args->data_available);
+        int found = 0;
         for (int i = 0; i < d_args->num_producers; i++) {
-            if (sem_trywait(&d_args->producer_queues[i].full) == 0) {
-                char *message = remove_bounded_buffer(&d_args->producer_queues[i]);
+            if (bounded_buffer_count(d_args->producer_queues[i]) == 0) {
+                continue;
+            }
+            size_t length;
+            const char *message = try_peek_bounded_buffer_record(d_args->producer_queues[i], &length);
+            if (message != NULL) {
+                found = 1;
                 if (strcmp(message, "DONE") == 0) {
                     num_done++;
                 } else {
-                    char type[MAX_STRING_LENGTH];
-                    sscanf(message, "%*s %*d %s %*d", type);
+                    char type[MAX_STRING_LENGTH] = "";
+                    sscanf(message, "%*s %*d %99s", type); // Bound the token, messages themselves have no length limit
                     if (strcmp(type, "SPORTS") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[0], message);
+                        forward(d_args->dispatcher_queues[0], message, length);
                     } else if (strcmp(type, "NEWS") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[1], message);
+                        forward(d_args->dispatcher_queues[1], message, length);
                     } else if (strcmp(type, "WEATHER") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[2], message);
+                        forward(d_args->dispatcher_queues[2], message, length);
                     }
                 }
-                sem_post(&d_args->producer_queues[i].full);
-                printf("Dispatcher processed message: %s\n", message);
-                free(message); // Free the allocated message memory
+                ASYNC_LOG(LOG_LEVEL_DEBUG, "Dispatcher processed message: %s\n", message);
+                release_bounded_buffer(d_args->producer_queues[i]);
             }
         }
+        if (!found && num_done < d_args->num_producers) {
+            wait_buffer_signal(d_args->data_available, seen);
+        }
     }
     for (int i = 0; i < NUM_TYPES; i++) {
-        insert_bounded_buffer(&d_args->dispatcher_queues[i], "DONE");
-        printf("Dispatcher sent DONE to co-editor %d\n", i);
+        insert_bounded_buffer(d_args->dispatcher_queues[i], "DONE");
+        ASYNC_LOG(LOG_LEVEL_INFO, "Dispatcher sent DONE to co-editor %d\n", i);
     }
     return NULL;
 }
@@ -243,17 +133,18 @@ void *dispatcher_thread(void *args) {
 void *co_editor_thread(void *args) {
     CoEditorArgs *ce_args = (CoEditorArgs *)args;
     while (1) {
-        char *message = remove_bounded_buffer(ce_args->dispatcher_queue);
+        size_t length;
+        const char *message = peek_bounded_buffer_record(ce_args->dispatcher_queue, &length);
         if (strcmp(message, "DONE") == 0) {
             insert_bounded_buffer(ce_args->shared_queue, "DONE");
-            printf("Co-editor %s received DONE\n", ce_args->type);
-            free(message); // Free the allocated message memory
+            ASYNC_LOG(LOG_LEVEL_INFO, "Co-editor %s received DONE\n", ce_args->type);
+            release_bounded_buffer(ce_args->dispatcher_queue);
             break;
         }
         usleep(100000);  // Simulate editing by sleeping for 0.1 seconds
-        insert_bounded_buffer(ce_args->shared_queue, message);
-        printf("Co-editor %s edited message: %s\n", ce_args->type, message);
-        free(message); // Free the allocated message memory
+        forward(ce_args->shared_queue, message, length);
+        ASYNC_LOG(LOG_LEVEL_DEBUG, "Co-editor %s edited message: %s\n", ce_args->type, message);
+        release_bounded_buffer(ce_args->dispatcher_queue);
     }
     return NULL;
 }
@@ -262,83 +153,182 @@ void *screen_manager_thread(void *args) {
     ScreenManagerArgs *sm_args = (ScreenManagerArgs *)args;
     int num_done = 0;
     while (num_done < NUM_TYPES) {
-        char *message = remove_bounded_buffer(sm_args->shared_queue);
+        const char *message = peek_bounded_buffer(sm_args->shared_queue);
         if (strcmp(message, "DONE") == 0) {
             num_done++;
-            printf("Screen manager received DONE %d\n", num_done);
-            free(message); // Free the allocated message memory
+            ASYNC_LOG(LOG_LEVEL_INFO, "Screen manager received DONE %d\n", num_done);
         } else {
-            printf("Screen manager displaying message: %s\n", message);
-            free(message); // Free the allocated message memory
+            ASYNC_LOG(LOG_LEVEL_INFO, "Screen manager displaying message: %s\n", message);
         }
+        release_bounded_buffer(sm_args->shared_queue);
     }
     return NULL;
 }
 
-int main() {
-    // Initialize your program
-    srand(time(NULL));
-    BoundedBuffer producer_queues[3];
-    for (int i = 0; i < NUM_TYPES; i++) {
-        producer_queues[i] = *create_bounded_buffer(10);
+// Read the producers and the co-editor queue size in one pass over the config file
+static ProducerArgs *read_config(const char *filename, int *num_producers, int *ce_queue_size) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Error opening config file");
+        exit(EXIT_FAILURE);
+    }
+
+    int capacity = 16;
+    int count = 0;
+    ProducerArgs *producers = (ProducerArgs *)malloc(capacity * sizeof(ProducerArgs));
+    if (producers == NULL) {
+        perror("Error allocating producers");
+        exit(EXIT_FAILURE);
+    }
+
+    *ce_queue_size = 0;
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, "PRODUCER") != NULL) {
+            if (count == capacity) {
+                capacity *= 2;
+                producers = (ProducerArgs *)realloc(producers, capacity * sizeof(ProducerArgs));
+                if (producers == NULL) {
+                    perror("Error growing producers");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            ProducerArgs *producer = &producers[count];
+            if (sscanf(strstr(line, "PRODUCER"), "PRODUCER %d", &producer->id) != 1) {
+                producer->id = count + 1;
+            }
+            if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "%d", &producer->num_products) != 1 ||
+                fgets(line, sizeof(line), file) == NULL || strchr(line, '=') == NULL ||
+                sscanf(strchr(line, '=') + 1, "%d", &producer->queue_size) != 1 ||
+                producer->num_products < 0 || producer->queue_size <= 0) {
+                fprintf(stderr, "Error: invalid PRODUCER %d in config file\n", producer->id);
+                exit(EXIT_FAILURE);
+            }
+            count++;
+        } else if (strstr(line, "Co-Editor queue size") != NULL && strchr(line, '=') != NULL) {
+            sscanf(strchr(line, '=') + 1, "%d", ce_queue_size);
+        }
+    }
+    fclose(file);
+
+    *num_producers = count;
+    return producers;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <config file> [producer threads]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int num_producers;
+    int ce_queue_size;
+    ProducerArgs *p_args = read_config(argv[1], &num_producers, &ce_queue_size);
+    if (ce_queue_size <= 0) {
+        fprintf(stderr, "Error: Co-Editor queue size must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Producers that wait on a full queue hold their pool thread, the dispatcher keeps draining every queue
+    // so they always move on; by default run one producer per CPU at a time
+    long num_workers = argc == 3 ? strtol(argv[2], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers <= 0) {
+        num_workers = 1;
+    }
+    if (num_workers > num_producers) {
+        num_workers = num_producers;
+    }
+
+    // Per-message traces only show with LOG_LEVEL=debug
+    async_log_start(STDOUT_FILENO, LOG_LEVEL_INFO);
+
+    BufferSignal *data_available = create_buffer_signal();
+    BoundedBuffer **producer_queues = (BoundedBuffer **)malloc((num_producers + 1) * sizeof(BoundedBuffer *));
+    pthread_t *workers = (pthread_t *)malloc((num_workers + 1) * sizeof(pthread_t));
+    if (producer_queues == NULL || workers == NULL) {
+        perror("Error allocating thread tables");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_producers; i++) {
+        p_args[i].queue = create_single_producer_bounded_buffer(p_args[i].queue_size);
+        attach_buffer_signal(p_args[i].queue, data_available);
+        producer_queues[i] = p_args[i].queue;
     }
     
-    BoundedBuffer dispatcher_queues[3];
+    BoundedBuffer *dispatcher_queues[NUM_TYPES];
     for (int i = 0; i < NUM_TYPES; i++) {
-        dispatcher_queues[i] = *create_bounded_buffer(10);
+        dispatcher_queues[i] = create_single_producer_bounded_buffer(ce_queue_size);
     }
     
-    BoundedBuffer shared_queue = *create_bounded_buffer(10);
+    // The co-editors all insert into the shared queue
+    BoundedBuffer *shared_queue = create_bounded_buffer(ce_queue_size);
     
-    pthread_t producers[NUM_TYPES];
-    ProducerArgs p_args[NUM_TYPES];
-    for (int i = 0; i < NUM_TYPES; i++) {
-        p_args[i].id = i + 1;
-        p_args[i].num_products = 5; // Number of products each producer will produce
-        p_args[i].queue = &producer_queues[i];
-        pthread_create(&producers[i], NULL, producer_thread, (void *)&p_args[i]);
+    ProducerPool pool;
+    pool.producers = p_args;
+    pool.num_producers = num_producers;
+    atomic_init(&pool.next, 0);
+    for (long i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i], NULL, producer_pool_thread, (void *)&pool) != 0) {
+            perror("Error creating producer thread");
+            exit(EXIT_FAILURE);
+        }
     }
     
     pthread_t dispatcher;
     DispatcherArgs d_args;
     d_args.producer_queues = producer_queues;
     d_args.dispatcher_queues = dispatcher_queues;
-    d_args.num_producers = NUM_TYPES;
-    pthread_create(&dispatcher, NULL, dispatcher_thread, (void *)&d_args);
+    d_args.num_producers = num_producers;
+    d_args.data_available = data_available;
+    if (pthread_create(&dispatcher, NULL, dispatcher_thread, (void *)&d_args) != 0) {
+        perror("Error creating dispatcher thread");
+        exit(EXIT_FAILURE);
+    }
     
     pthread_t co_editors[NUM_TYPES];
     CoEditorArgs ce_args[NUM_TYPES];
     const char *types[NUM_TYPES] = {"SPORTS", "NEWS", "WEATHER"};
     for (int i = 0; i < NUM_TYPES; i++) {
-        ce_args[i].dispatcher_queue = &dispatcher_queues[i];
-        ce_args[i].shared_queue = &shared_queue;
+        ce_args[i].dispatcher_queue = dispatcher_queues[i];
+        ce_args[i].shared_queue = shared_queue;
         ce_args[i].type = types[i];
-        pthread_create(&co_editors[i], NULL, co_editor_thread, (void *)&ce_args[i]);
+        if (pthread_create(&co_editors[i], NULL, co_editor_thread, (void *)&ce_args[i]) != 0) {
+            perror("Error creating co-editor thread");
+            exit(EXIT_FAILURE);
+        }
     }
     
     pthread_t screen_manager;
     ScreenManagerArgs sm_args;
-    sm_args.shared_queue = &shared_queue;
-    pthread_create(&screen_manager, NULL, screen_manager_thread, (void *)&sm_args);
+    sm_args.shared_queue = shared_queue;
+    if (pthread_create(&screen_manager, NULL, screen_manager_thread, (void *)&sm_args) != 0) {
+        perror("Error creating screen manager thread");
+        exit(EXIT_FAILURE);
+    }
     
     // Join threads
-    for (int i = 0; i < NUM_TYPES; i++) {
-        pthread_join(producers[i], NULL);
+    for (long i = 0; i < num_workers; i++) {
+        pthread_join(workers[i], NULL);
     }
     pthread_join(dispatcher, NULL);
     for (int i = 0; i < NUM_TYPES; i++) {
         pthread_join(co_editors[i], NULL);
     }
     pthread_join(screen_manager, NULL);
+    async_log_stop();
     
     // Clean up resources
-    for (int i = 0; i < NUM_TYPES; i++) {
-        destroy_bounded_buffer(&producer_queues[i]);
+    for (int i = 0; i < num_producers; i++) {
+        destroy_bounded_buffer(producer_queues[i]);
     }
     for (int i = 0; i < NUM_TYPES; i++) {
-        destroy_bounded_buffer(&dispatcher_queues[i]);
+        destroy_bounded_buffer(dispatcher_queues[i]);
     }
-    destroy_bounded_buffer(&shared_queue);
+    destroy_bounded_buffer(shared_queue);
+    destroy_buffer_signal(data_available);
+    free(producer_queues);
+    free(workers);
+    free(p_args);
     
     return 0;
 }
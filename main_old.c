@@ -2,22 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <unistd.h>
+#include "async_log.h"
+#include "bounded_buffer.h"
 
 #define MAX_STRING_LENGTH 100
 #define NUM_TYPES 3
 
-typedef struct {
-    char **buffer;
-    int size;
-    int in;
-    int out;
-    sem_t full;
-    sem_t empty;
-    pthread_mutex_t mutex;
-} BoundedBuffer;
-
 typedef struct {
     int id;
     int num_products;
@@ -25,8 +16,8 @@ typedef struct {
 } ProducerArgs;
 
 typedef struct {
-    BoundedBuffer *producer_queues;
-    BoundedBuffer *dispatcher_queues;
+    BoundedBuffer **producer_queues;
+    BoundedBuffer **dispatcher_queues;
     int num_producers;
 } DispatcherArgs;
 
@@ -40,135 +31,11 @@ typedef struct {
     BoundedBuffer *shared_queue;
 } ScreenManagerArgs;
 
-BoundedBuffer *create_bounded_buffer(int size);
-void insert_bounded_buffer(BoundedBuffer *bb, const char *str);
-char *remove_bounded_buffer(BoundedBuffer *bb);
-void destroy_bounded_buffer(BoundedBuffer *bb);
-
 void *producer_thread(void *args);
 void *dispatcher_thread(void *args);
 void *co_editor_thread(void *args);
 void *screen_manager_thread(void *args);
 
-BoundedBuffer *create_bounded_buffer(int size) {
-    BoundedBuffer *bb = (BoundedBuffer *)malloc(sizeof(BoundedBuffer));
-    if (bb == NULL) {
-        perror("Error allocating BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    bb->buffer = (char **)malloc(size * sizeof(char *));
-    if (bb->buffer == NULL) {
-        perror("Error allocating buffer in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    for (int i = 0; i < size; i++) {
-        bb->buffer[i] = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
-        if (bb->buffer[i] == NULL) {
-            perror("Error allocating buffer element in BoundedBuffer");
-            exit(EXIT_FAILURE);
-        }
-    }
-    
-    bb->size = size;
-    bb->in = 0;
-    bb->out = 0;
-    
-    if (sem_init(&bb->full, 0, 0) != 0) {
-        perror("Error initializing full semaphore in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_init(&bb->empty, 0, size) != 0) {
-        perror("Error initializing empty semaphore in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_init(&bb->mutex, NULL) != 0) {
-        perror("Error initializing mutex in BoundedBuffer");
-        exit(EXIT_FAILURE);
-    }
-    
-    return bb;
-}
-
-void insert_bounded_buffer(BoundedBuffer *bb, const char *str) {
-    if (sem_wait(&bb->empty) != 0) {
-        perror("Error waiting on empty semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_lock(&bb->mutex) != 0) {
-        perror("Error locking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    strncpy(bb->buffer[bb->in], str, MAX_STRING_LENGTH);
-    bb->in = (bb->in + 1) % bb->size;
-    
-    if (pthread_mutex_unlock(&bb->mutex) != 0) {
-        perror("Error unlocking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_post(&bb->full) != 0) {
-        perror("Error posting to full semaphore");
-        exit(EXIT_FAILURE);
-    }
-}
-
-char *remove_bounded_buffer(BoundedBuffer *bb) {
-    if (sem_wait(&bb->full) != 0) {
-        perror("Error waiting on full semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_lock(&bb->mutex) != 0) {
-        perror("Error locking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    char *str = strdup(bb->buffer[bb->out]); // Make a copy of the string to return
-    bb->out = (bb->out + 1) % bb->size;
-    
-    if (pthread_mutex_unlock(&bb->mutex) != 0) {
-        perror("Error unlocking mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_post(&bb->empty) != 0) {
-        perror("Error posting to empty semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    return str;
-}
-
-void destroy_bounded_buffer(BoundedBuffer *bb) {
-    for (int i = 0; i < bb->size; i++) {
-        free(bb->buffer[i]);
-    }
-    free(bb->buffer);
-    
-    if (sem_destroy(&bb->full) != 0) {
-        perror("Error destroying full semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (sem_destroy(&bb->empty) != 0) {
-        perror("Error destroying empty semaphore");
-        exit(EXIT_FAILURE);
-    }
-    
-    if (pthread_mutex_destroy(&bb->mutex) != 0) {
-        perror("Error destroying mutex");
-        exit(EXIT_FAILURE);
-    }
-    
-    free(bb);
-}
-
 void *producer_thread(void *args) {
     ProducerArgs *p_args = (ProducerArgs *)args;
     const char *types[] = {"SPORTS", "NEWS", "WEATHER"};
@@ -177,10 +44,10 @@ void *producer_thread(void *args) {
         char product[MAX_STRING_LENGTH];
         snprintf(product, MAX_STRING_LENGTH, "Producer %d %s %d", p_args->id, types[type_idx], i);
         insert_bounded_buffer(p_args->queue, product);
-        printf("Producer %d produced %s\n", p_args->id, product);
+        ASYNC_LOG(LOG_LEVEL_DEBUG, "Producer %d produced %s\n", p_args->id, product);
     }
     insert_bounded_buffer(p_args->queue, "DONE");
-    printf("Producer %d done\n", p_args->id);
+    ASYNC_LOG(LOG_LEVEL_INFO, "Producer %d done\n", p_args->id);
     return NULL;
 }
 
@@ -189,30 +56,33 @@ void *dispatcher_thread(void *args) {
     int num_done = 0;
     while (num_done < d_args->num_producers) {
         for (int i = 0; i < d_args->num_producers; i++) {
-            if (sem_trywait(&d_args->producer_queues[i].full) == 0) {
-                char *message = remove_bounded_buffer(&d_args->producer_queues[i]);
+            char *message = try_remove_bounded_buffer(d_args->producer_queues[i]);
+            if (message != NULL) {
                 if (strcmp(message, "DONE") == 0) {
                     num_done++;
                 } else {
                     char type[MAX_STRING_LENGTH];
                     sscanf(message, "%*s %*d %s %*d", type);
+                    int queue = -1;
                     if (strcmp(type, "SPORTS") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[0], message);
+                        queue = 0;
                     } else if (strcmp(type, "NEWS") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[1], message);
+                        queue = 1;
                     } else if (strcmp(type, "WEATHER") == 0) {
-                        insert_bounded_buffer(&d_args->dispatcher_queues[2], message);
+                        queue = 2;
+                    }
+                    if (queue != -1 && insert_bounded_buffer(d_args->dispatcher_queues[queue], message) == -1) {
+                        perror("Error dispatching message");
                     }
                 }
-                sem_post(&d_args->producer_queues[i].full);
-                printf("Dispatcher processed message: %s\n", message);
+                ASYNC_LOG(LOG_LEVEL_DEBUG, "Dispatcher processed message: %s\n", message);
                 free(message); // Free the allocated message memory
             }
         }
     }
     for (int i = 0; i < NUM_TYPES; i++) {
-        insert_bounded_buffer(&d_args->dispatcher_queues[i], "DONE");
-        printf("Dispatcher sent DONE to co-editor %d\n", i);
+        insert_bounded_buffer(d_args->dispatcher_queues[i], "DONE");
+        ASYNC_LOG(LOG_LEVEL_INFO, "Dispatcher sent DONE to co-editor %d\n", i);
     }
     return NULL;
 }
@@ -223,13 +93,15 @@ void *co_editor_thread(void *args) {
         char *message = remove_bounded_buffer(ce_args->dispatcher_queue);
         if (strcmp(message, "DONE") == 0) {
             insert_bounded_buffer(ce_args->shared_queue, "DONE");
-            printf("Co-editor %s received DONE\n", ce_args->type);
+            ASYNC_LOG(LOG_LEVEL_INFO, "Co-editor %s received DONE\n", ce_args->type);
             free(message); // Free the allocated message memory
             break;
         }
         usleep(100000);  // Simulate editing by sleeping for 0.1 seconds
-        insert_bounded_buffer(ce_args->shared_queue, message);
-        printf("Co-editor %s edited message: %s\n", ce_args->type, message);
+        if (insert_bounded_buffer(ce_args->shared_queue, message) == -1) {
+            perror("Error forwarding edited message");
+        }
+        ASYNC_LOG(LOG_LEVEL_DEBUG, "Co-editor %s edited message: %s\n", ce_args->type, message);
         free(message); // Free the allocated message memory
     }
     return NULL;
@@ -242,14 +114,14 @@ void *screen_manager_thread(void *args) {
         char *message = remove_bounded_buffer(sm_args->shared_queue);
         if (strcmp(message, "DONE") == 0) {
             num_done++;
-            printf("Screen manager received DONE %d\n", num_done);
+            ASYNC_LOG(LOG_LEVEL_INFO, "Screen manager received DONE %d\n", num_done);
             free(message); // Free the allocated message memory
         } else {
-            printf("Screen manager displayed: %s\n", message);
+            ASYNC_LOG(LOG_LEVEL_INFO, "Screen manager displayed: %s\n", message);
             free(message); // Free the allocated message memory
         }
     }
-    printf("Screen manager DONE\n");
+    ASYNC_LOG(LOG_LEVEL_INFO, "Screen manager DONE\n");
     return NULL;
 }
 
@@ -299,7 +171,7 @@ void read_config(const char *filename, int *num_producers, ProducerArgs **p_args
                 exit(EXIT_FAILURE);
             }
             (*p_args)[producer_index].queue = create_bounded_buffer(queue_size);
-            printf("Configured Producer %d with queue size %d\n", (*p_args)[producer_index].id, queue_size);
+            ASYNC_LOG(LOG_LEVEL_INFO, "Configured Producer %d with queue size %d\n", (*p_args)[producer_index].id, queue_size);
             producer_index++;
         }
     }
@@ -309,7 +181,7 @@ void read_config(const char *filename, int *num_producers, ProducerArgs **p_args
         fprintf(stderr, "Error: Could not read Co-Editor queue size\n");
         exit(EXIT_FAILURE);
     }
-    printf("Configured Co-Editor queue size %d\n", *ce_queue_size);
+    ASYNC_LOG(LOG_LEVEL_INFO, "Configured Co-Editor queue size %d\n", *ce_queue_size);
 
     fclose(file);
 }
@@ -320,6 +192,8 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    async_log_start(STDOUT_FILENO, LOG_LEVEL_INFO);
+
     int num_producers;
     ProducerArgs *p_args;
     int ce_queue_size;
@@ -332,25 +206,29 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    BoundedBuffer *dispatcher_queues = (BoundedBuffer *)malloc(NUM_TYPES * sizeof(BoundedBuffer));
-    if (dispatcher_queues == NULL) {
-        perror("Error allocating dispatcher queues");
+    BoundedBuffer **producer_queues = (BoundedBuffer **)malloc(num_producers * sizeof(BoundedBuffer *));
+    if (producer_queues == NULL) {
+        perror("Error allocating producer queues");
         exit(EXIT_FAILURE);
     }
-    
+    for (int i = 0; i < num_producers; i++) {
+        producer_queues[i] = p_args[i].queue;
+    }
+
+    BoundedBuffer *dispatcher_queues[NUM_TYPES];
     for (int i = 0; i < NUM_TYPES; i++) {
-        dispatcher_queues[i] = *create_bounded_buffer(ce_queue_size);
-        printf("Created dispatcher queue for type %d with size %d\n", i, ce_queue_size);
+        dispatcher_queues[i] = create_bounded_buffer(ce_queue_size);
+        ASYNC_LOG(LOG_LEVEL_INFO, "Created dispatcher queue for type %d with size %d\n", i, ce_queue_size);
     }
 
     BoundedBuffer *shared_queue = create_bounded_buffer(ce_queue_size);
-    printf("Created shared queue with size %d\n", ce_queue_size);
+    ASYNC_LOG(LOG_LEVEL_INFO, "Created shared queue with size %d\n", ce_queue_size);
 
-    DispatcherArgs d_args = {NULL, dispatcher_queues, num_producers};
+    DispatcherArgs d_args = {producer_queues, dispatcher_queues, num_producers};
     CoEditorArgs ce_args[NUM_TYPES] = {
-        {&dispatcher_queues[0], shared_queue, "SPORTS"},
-        {&dispatcher_queues[1], shared_queue, "NEWS"},
-        {&dispatcher_queues[2], shared_queue, "WEATHER"}
+        {dispatcher_queues[0], shared_queue, "SPORTS"},
+        {dispatcher_queues[1], shared_queue, "NEWS"},
+        {dispatcher_queues[2], shared_queue, "WEATHER"}
     };
     ScreenManagerArgs sm_args = {shared_queue};
 
@@ -360,74 +238,74 @@ int main(int argc, char *argv[]) {
     pthread_t screen_manager_thread_id;
 
     for (int i = 0; i < num_producers; i++) {
-        d_args.producer_queues = p_args[i].queue;
         if (pthread_create(&producer_threads[i], NULL, producer_thread, &p_args[i]) != 0) {
             perror("Error creating producer thread");
             exit(EXIT_FAILURE);
         }
-        printf("Started Producer %d\n", p_args[i].id);
+        ASYNC_LOG(LOG_LEVEL_INFO, "Started Producer %d\n", p_args[i].id);
     }
 
     if (pthread_create(&dispatcher_thread_id, NULL, dispatcher_thread, &d_args) != 0) {
         perror("Error creating dispatcher thread");
         exit(EXIT_FAILURE);
     }
-    printf("Started Dispatcher\n");
+    ASYNC_LOG(LOG_LEVEL_INFO, "Started Dispatcher\n");
 
     for (int i = 0; i < NUM_TYPES; i++) {
         if (pthread_create(&co_editor_threads[i], NULL, co_editor_thread, &ce_args[i]) != 0) {
             perror("Error creating co-editor thread");
             exit(EXIT_FAILURE);
         }
-        printf("Started Co-Editor %s\n", ce_args[i].type);
+        ASYNC_LOG(LOG_LEVEL_INFO, "Started Co-Editor %s\n", ce_args[i].type);
     }
 
     if (pthread_create(&screen_manager_thread_id, NULL, screen_manager_thread, &sm_args) != 0) {
         perror("Error creating screen manager thread");
         exit(EXIT_FAILURE);
     }
-    printf("Started Screen Manager\n");
+    ASYNC_LOG(LOG_LEVEL_INFO, "Started Screen Manager\n");
 
     for (int i = 0; i < num_producers; i++) {
         if (pthread_join(producer_threads[i], NULL) != 0) {
             perror("Error joining producer thread");
             exit(EXIT_FAILURE);
         }
-        printf("Joined Producer %d\n", p_args[i].id);
+        ASYNC_LOG(LOG_LEVEL_INFO, "Joined Producer %d\n", p_args[i].id);
     }
 
     if (pthread_join(dispatcher_thread_id, NULL) != 0) {
         perror("Error joining dispatcher thread");
         exit(EXIT_FAILURE);
     }
-    printf("Joined Dispatcher\n");
+    ASYNC_LOG(LOG_LEVEL_INFO, "Joined Dispatcher\n");
 
     for (int i = 0; i < NUM_TYPES; i++) {
         if (pthread_join(co_editor_threads[i], NULL) != 0) {
             perror("Error joining co-editor thread");
             exit(EXIT_FAILURE);
         }
-        printf("Joined Co-Editor %s\n", ce_args[i].type);
+        ASYNC_LOG(LOG_LEVEL_INFO, "Joined Co-Editor %s\n", ce_args[i].type);
     }
 
     if (pthread_join(screen_manager_thread_id, NULL) != 0) {
         perror("Error joining screen manager thread");
         exit(EXIT_FAILURE);
     }
-    printf("Joined Screen Manager\n");
+    ASYNC_LOG(LOG_LEVEL_INFO, "Joined Screen Manager\n");
+    async_log_stop();
 
     for (int i = 0; i < num_producers; i++) {
         destroy_bounded_buffer(p_args[i].queue);
     }
 
     for (int i = 0; i < NUM_TYPES; i++) {
-        destroy_bounded_buffer(&dispatcher_queues[i]);
+        destroy_bounded_buffer(dispatcher_queues[i]);
     }
 
     destroy_bounded_buffer(shared_queue);
 
     free(p_args);
-    free(dispatcher_queues);
+    free(producer_queues);
 
     return 0;
 }
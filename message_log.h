@@ -0,0 +1,162 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Binary log of produced messages.
+//
+// The file starts with an 8 byte magic followed by one record per message:
+//   varint producer id | varint nanoseconds since the previous record | varint length | bytes
+// Varints are LEB128 so a typical record costs only a few bytes on top of the message text.
+namespace message_log
+{
+    static const char MAGIC[8] = { 'M', 'S', 'G', 'L', 'O', 'G', '1', '\0' };
+
+    inline void putVarint(std::vector<char>& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Read one varint from the stream, returns false on a clean end of file
+    inline bool getVarint(std::istream& in, uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int byte = in.get();
+            if (byte == std::char_traits<char>::eof())
+            {
+                if (shift == 0)
+                {
+                    return false;
+                }
+                throw std::runtime_error("truncated message log");
+            }
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        throw std::runtime_error("corrupt varint in message log");
+    }
+}
+
+// A message read back from a log, with its offset from the start of the recording
+struct LoggedMessage
+{
+    std::chrono::nanoseconds offset;
+    std::string text;
+};
+
+// Appends every produced message to a binary log, shared by all producer threads
+class MessageRecorder
+{
+public:
+    explicit MessageRecorder(const std::string& path)
+        : file(path, std::ios::binary | std::ios::trunc), last(std::chrono::steady_clock::now())
+    {
+        if (!file)
+        {
+            throw std::runtime_error("cannot open message log " + path);
+        }
+        file.write(message_log::MAGIC, sizeof(message_log::MAGIC));
+        pending.reserve(FLUSH_THRESHOLD + 256);
+    }
+
+    ~MessageRecorder()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        flushLocked();
+    }
+
+    MessageRecorder(const MessageRecorder&) = delete;
+    MessageRecorder& operator=(const MessageRecorder&) = delete;
+
+    // Record a message; the timestamp is taken under the lock so the log stays ordered
+    void record(int producerId, const std::string& message)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        uint64_t delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+
+        message_log::putVarint(pending, static_cast<uint64_t>(producerId));
+        message_log::putVarint(pending, delta);
+        message_log::putVarint(pending, message.size());
+        pending.insert(pending.end(), message.begin(), message.end());
+
+        if (pending.size() >= FLUSH_THRESHOLD)
+        {
+            flushLocked();
+        }
+    }
+
+private:
+    static const size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    void flushLocked()
+    {
+        file.write(pending.data(), pending.size());
+        file.flush();
+        pending.clear();
+    }
+
+    std::ofstream file;
+    std::vector<char> pending;
+    std::chrono::steady_clock::time_point last;
+    std::mutex mutex;
+};
+
+// Load a log and split its messages per producer id, keeping the recorded offsets
+inline std::map<int, std::vector<LoggedMessage>> loadMessageLog(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("cannot open message log " + path);
+    }
+
+    char magic[sizeof(message_log::MAGIC)];
+    if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), message_log::MAGIC))
+    {
+        throw std::runtime_error(path + " is not a message log");
+    }
+
+    std::map<int, std::vector<LoggedMessage>> messages;
+    std::chrono::nanoseconds offset(0);
+    uint64_t producerId;
+    while (message_log::getVarint(file, producerId))
+    {
+        uint64_t delta;
+        uint64_t length;
+        if (!message_log::getVarint(file, delta) || !message_log::getVarint(file, length))
+        {
+            throw std::runtime_error("truncated message log");
+        }
+        offset += std::chrono::nanoseconds(delta);
+
+        std::string text(length, '\0');
+        if (!file.read(&text[0], length))
+        {
+            throw std::runtime_error("truncated message log");
+        }
+        messages[static_cast<int>(producerId)].push_back({ offset, std::move(text) });
+    }
+    return messages;
+}
+
+#endif
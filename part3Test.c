@@ -1,8 +1,10 @@
 #include "buffered_open.h"
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 const char *filename = "Test3Output.txt";
 
@@ -403,6 +405,506 @@ int test6(){
     // ============================= END OF TEST 6: Sequential Read to file ==============================================
 }
 
+int test7(){
+    // ============================= TEST 7: Prepend across several buffer flushes =============================
+    const char *previousContent = "Test5Test5Test5Test2Test1Test3Test5Test5Test5Test5";
+    char inputFirst[BUFFER_SIZE];
+    char inputSecond[100];
+    memset(inputFirst, 'A', sizeof(inputFirst));
+    memset(inputSecond, 'B', sizeof(inputSecond));
+    size_t expectedLength = sizeof(inputSecond) + sizeof(inputFirst) + strlen(previousContent);
+    // Every flush goes in front of the previous ones: the full buffer of A's flushes first
+    char *expectedOutTest7 = (char *)malloc(expectedLength + 1);
+    char *readBuffer = (char *)calloc(expectedLength + 2, 1);
+    if (!expectedOutTest7 || !readBuffer) {
+        perror("malloc 7");
+        return 1;
+    }
+    memcpy(expectedOutTest7, inputSecond, sizeof(inputSecond));
+    memcpy(expectedOutTest7 + sizeof(inputSecond), inputFirst, sizeof(inputFirst));
+    strcpy(expectedOutTest7 + sizeof(inputSecond) + sizeof(inputFirst), previousContent);
+
+    buffered_file_t *bf = buffered_open(filename, O_RDWR | O_PREAPPEND, 0);
+    if (!bf) {
+        perror("buffered_open 7");
+        return 1;
+    }
+    if (buffered_write(bf, inputFirst, sizeof(inputFirst)) == -1) {
+        perror("buffered_write 7");
+        buffered_close(bf);
+        return 1;
+    }
+    if (buffered_write(bf, inputSecond, sizeof(inputSecond)) == -1) {
+        perror("buffered_write 7");
+        buffered_close(bf);
+        return 1;
+    }
+    // Close the buffered file, the prepended data is placed in the file here
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 7");
+        return 1;
+    }
+    // Reopen file for reading with standard I/O to verify contents
+    int fd = open(filename, O_RDWR);
+    if (fd == -1) {
+        perror("open 7");
+        return 1;
+    }
+    ssize_t bytes_read = read(fd, readBuffer, expectedLength + 1);
+    if (bytes_read == -1) {
+        perror("read 7");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    int passed = (size_t)bytes_read == expectedLength && strcmp(readBuffer, expectedOutTest7) == 0;
+    free(expectedOutTest7);
+    free(readBuffer);
+    if (passed) {
+        printf("\033[0;32mTEST 7: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 7: FAILED\n\033[0m");
+        printf("\033[0;31mExpected %zu bytes, read %zd\n\033[0m", expectedLength, bytes_read);
+        return -1;
+    }
+    // ============================= END OF TEST 7: Prepend across several buffer flushes ========================
+}
+
+int test8(){
+    // ============================= TEST 8: Read prepended data before it is compacted =====================
+    const char *inputTest8 = "Head";
+    char readBuffer[1024] = {0};
+    const char *expectedOutTest8 = "HeadBBBB";
+    buffered_file_t *bf = buffered_open(filename, O_RDWR | O_PREAPPEND, 0);
+    if (!bf) {
+        perror("buffered_open 8");
+        return 1;
+    }
+    if (buffered_write(bf, inputTest8, strlen(inputTest8)) == -1) {
+        perror("buffered_write 8");
+        buffered_close(bf);
+        return 1;
+    }
+    // The read sees the prepended data while it still sits in the journal
+    ssize_t bytes_read = buffered_read(bf, readBuffer, strlen(expectedOutTest8));
+    if (bytes_read == -1) {
+        perror("buffered_read 8");
+        buffered_close(bf);
+        return 1;
+    }
+    if (buffered_compact(bf) == -1) {
+        perror("buffered_compact 8");
+        buffered_close(bf);
+        return 1;
+    }
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 8");
+        return 1;
+    }
+    readBuffer[bytes_read] = '\0';  // Null-terminate the string
+
+    if (strcmp(readBuffer, expectedOutTest8) == 0) {
+        printf("\033[0;32mTEST 8: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 8: FAILED\n\033[0m");
+        printf("\033[0;32mExpected output: %s \n\033[0m" , expectedOutTest8);
+        printf("\033[0;31mActual output: %s \n\033[0m", readBuffer);
+        return -1;
+    }
+    // ============================= END OF TEST 8: Read prepended data before it is compacted ==============
+}
+
+int test9(){
+    // ============================= TEST 9: Small growing buffers with buffered_open_ex ====================
+    // Buffers start at 16 bytes and double up to 64 while the data streams through them
+    buffered_options_t options = { .read_buffer_size = 16, .write_buffer_size = 16, .max_buffer_size = 64 };
+    const char *inputTest9 = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char readBuffer[1024] = {0};
+    char expectedOutTest9[1024] = {0};
+    for (int i = 0; i < 10; i++) {
+        strcat(expectedOutTest9, inputTest9);
+    }
+    buffered_file_t *bf = buffered_open_ex(filename, O_RDWR | O_CREAT | O_TRUNC, 0644, &options);
+    if (!bf) {
+        perror("buffered_open_ex 9");
+        return 1;
+    }
+    for (int i = 0; i < 10; i++) {
+        if (buffered_write(bf, inputTest9, strlen(inputTest9)) == -1) {
+            perror("buffered_write 9");
+            buffered_close(bf);
+            return 1;
+        }
+    }
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 9");
+        return 1;
+    }
+    bf = buffered_open_ex(filename, O_RDONLY, 0, &options);
+    if (!bf) {
+        perror("buffered_open_ex 9");
+        return 1;
+    }
+    size_t total = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = buffered_read(bf, readBuffer + total, 7)) > 0) {
+        total += bytes_read;
+    }
+    size_t grownCapacity = bf->read_capacity;
+    if (bytes_read == -1 || buffered_close(bf) == -1) {
+        perror("buffered_read 9");
+        return 1;
+    }
+    readBuffer[total] = '\0';  // Null-terminate the string
+
+    if (strcmp(readBuffer, expectedOutTest9) == 0 && grownCapacity == 64) {
+        printf("\033[0;32mTEST 9: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 9: FAILED\n\033[0m");
+        printf("\033[0;32mExpected output: %s \n\033[0m" , expectedOutTest9);
+        printf("\033[0;31mActual output: %s (read buffer grew to %zu bytes)\n\033[0m", readBuffer, grownCapacity);
+        return -1;
+    }
+    // ============================= END OF TEST 9: Small growing buffers with buffered_open_ex =============
+}
+
+int test10(){
+    // ============================= TEST 10: Writes and reads larger than the buffer ======================
+    const char *header = "Header";
+    size_t payloadLength = 3 * BUFFER_SIZE + 17;
+    char *payload = (char *)malloc(payloadLength);
+    char *readBuffer = (char *)malloc(payloadLength);
+    if (!payload || !readBuffer) {
+        perror("malloc 10");
+        return 1;
+    }
+    for (size_t i = 0; i < payloadLength; i++) {
+        payload[i] = 'a' + i % 26;
+    }
+    buffered_file_t *bf = buffered_open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!bf) {
+        perror("buffered_open 10");
+        return 1;
+    }
+    // The header waits in the buffer and goes out with the payload in one writev
+    if (buffered_write(bf, header, strlen(header)) == -1 || buffered_write(bf, payload, payloadLength) == -1) {
+        perror("buffered_write 10");
+        buffered_close(bf);
+        return 1;
+    }
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 10");
+        return 1;
+    }
+    bf = buffered_open(filename, O_RDONLY, 0);
+    if (!bf) {
+        perror("buffered_open 10");
+        return 1;
+    }
+    char readHeader[16] = {0};
+    ssize_t header_read = buffered_read(bf, readHeader, strlen(header));
+    ssize_t bytes_read = buffered_read(bf, readBuffer, payloadLength);
+    if (header_read == -1 || bytes_read == -1) {
+        perror("buffered_read 10");
+        buffered_close(bf);
+        return 1;
+    }
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 10");
+        return 1;
+    }
+
+    int passed = strcmp(readHeader, header) == 0 && (size_t)bytes_read == payloadLength &&
+                 memcmp(readBuffer, payload, payloadLength) == 0;
+    free(payload);
+    free(readBuffer);
+    if (passed) {
+        printf("\033[0;32mTEST 10: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 10: FAILED\n\033[0m");
+        printf("\033[0;31mRead header %s and %zd of %zu payload bytes\n\033[0m", readHeader, bytes_read, payloadLength);
+        return -1;
+    }
+    // ============================= END OF TEST 10: Writes and reads larger than the buffer ================
+}
+
+int test11(){
+    // ============================= TEST 11: Vectored records ============================================
+    const char *names[] = {"first", "second", "third"};
+    size_t payloadLength = 2 * BUFFER_SIZE;
+    char *payload = (char *)malloc(payloadLength);
+    char *readPayload = (char *)malloc(payloadLength);
+    if (!payload || !readPayload) {
+        perror("malloc 11");
+        return 1;
+    }
+    memset(payload, 'v', payloadLength);
+    buffered_file_t *bf = buffered_open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!bf) {
+        perror("buffered_open 11");
+        return 1;
+    }
+    // Two small records that stay in the buffer, then one with a payload that goes straight to writev
+    for (int i = 0; i < 3; i++) {
+        size_t length = i < 2 ? 10 : payloadLength;
+        struct iovec record[3] = {{(void *)names[i], 6}, {&length, sizeof(length)}, {payload, length}};
+        if (buffered_writev(bf, record, 3) != (ssize_t)(6 + sizeof(length) + length)) {
+            perror("buffered_writev 11");
+            buffered_close(bf);
+            return 1;
+        }
+    }
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 11");
+        return 1;
+    }
+    bf = buffered_open(filename, O_RDONLY, 0);
+    if (!bf) {
+        perror("buffered_open 11");
+        return 1;
+    }
+    int passed = 1;
+    for (int i = 0; i < 3; i++) {
+        char name[6];
+        size_t length = 0;
+        size_t expected = i < 2 ? 10 : payloadLength;
+        struct iovec record[3] = {{name, 6}, {&length, sizeof(length)}, {readPayload, expected}};
+        ssize_t bytes_read = buffered_readv(bf, record, 3);
+        if (bytes_read != (ssize_t)(6 + sizeof(length) + expected) || memcmp(name, names[i], 6) != 0 ||
+            length != expected || memcmp(readPayload, payload, expected) != 0) {
+            printf("\033[0;31mRecord %d came back as %zd bytes\n\033[0m", i, bytes_read);
+            passed = 0;
+        }
+    }
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 11");
+        return 1;
+    }
+    free(payload);
+    free(readPayload);
+    if (passed) {
+        printf("\033[0;32mTEST 11: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 11: FAILED\n\033[0m");
+        return -1;
+    }
+    // ============================= END OF TEST 11: Vectored records =====================================
+}
+
+int test12(){
+    // ============================= TEST 12: Mapped reads ================================================
+    const char *firstPart = "Mapped read ";
+    const char *secondPart = "after growth";
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, firstPart, strlen(firstPart)) == -1) {
+        perror("write 12");
+        return 1;
+    }
+    buffered_file_t *bf = buffered_open(filename, O_RDONLY | O_MMAPREAD, 0);
+    if (!bf) {
+        perror("buffered_open 12");
+        close(fd);
+        return 1;
+    }
+    // Look at the first word in place, then read the rest of the mapping
+    const void *data;
+    size_t length;
+    char readBuffer[64] = {0};
+    if (buffered_peek(bf, &data, &length) == -1) {
+        perror("buffered_peek 12");
+        buffered_close(bf);
+        close(fd);
+        return 1;
+    }
+    int passed = length == strlen(firstPart) && memcmp(data, "Mapped", 6) == 0;
+    buffered_consume(bf, 7);
+    ssize_t bytes_read = buffered_read(bf, readBuffer, sizeof(readBuffer));
+    passed = passed && bytes_read == 5 && strcmp(readBuffer, "read ") == 0;
+
+    // The file grows behind the mapping
+    if (write(fd, secondPart, strlen(secondPart)) == -1) {
+        perror("write 12");
+        buffered_close(bf);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    memset(readBuffer, 0, sizeof(readBuffer));
+    bytes_read = buffered_read(bf, readBuffer, sizeof(readBuffer));
+    passed = passed && bytes_read == (ssize_t)strlen(secondPart) && strcmp(readBuffer, secondPart) == 0;
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 12");
+        return 1;
+    }
+
+    if (passed) {
+        printf("\033[0;32mTEST 12: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 12: FAILED\n\033[0m");
+        printf("\033[0;31mLast read %zd bytes: %s\n\033[0m", bytes_read, readBuffer);
+        return -1;
+    }
+    // ============================= END OF TEST 12: Mapped reads =========================================
+}
+
+int test13(){
+    // ============================= TEST 13: Write-behind ================================================
+    // Three 16-byte buffers: most writes only fill a buffer while the flusher writes the previous ones
+    buffered_options_t options = { .write_buffer_size = 16, .write_behind_buffers = 3 };
+    const char *line = "write-behind line\n";
+    buffered_file_t *bf = buffered_open_ex(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644, &options);
+    if (!bf) {
+        perror("buffered_open_ex 13");
+        return 1;
+    }
+    for (int i = 0; i < 100; i++) {
+        if (buffered_write(bf, line, strlen(line)) == -1) {
+            perror("buffered_write 13");
+            buffered_close(bf);
+            return 1;
+        }
+    }
+    // Once flushed, every handed buffer is in the file
+    if (buffered_flush(bf) == -1) {
+        perror("buffered_flush 13");
+        buffered_close(bf);
+        return 1;
+    }
+    struct stat st;
+    int flushed = stat(filename, &st) == 0 && (size_t)st.st_size == 100 * strlen(line);
+    if (buffered_write(bf, line, strlen(line)) == -1 || buffered_close(bf) == -1) {
+        perror("buffered_close 13");
+        return 1;
+    }
+
+    char *readBuffer = (char *)malloc(101 * strlen(line) + 1);
+    int fd = open(filename, O_RDONLY);
+    if (!readBuffer || fd == -1) {
+        perror("open 13");
+        free(readBuffer);
+        return 1;
+    }
+    ssize_t bytes_read = read(fd, readBuffer, 101 * strlen(line) + 1);
+    close(fd);
+    int passed = flushed && bytes_read == (ssize_t)(101 * strlen(line));
+    for (int i = 0; passed && i < 101; i++) {
+        passed = memcmp(readBuffer + i * strlen(line), line, strlen(line)) == 0;
+    }
+    free(readBuffer);
+    if (passed) {
+        printf("\033[0;32mTEST 13: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 13: FAILED\n\033[0m");
+        printf("\033[0;31mFlushed %d, read %zd bytes\n\033[0m", flushed, bytes_read);
+        return -1;
+    }
+    // ============================= END OF TEST 13: Write-behind =========================================
+}
+
+int test14(){
+    // ============================= TEST 14: Read-ahead ==================================================
+    // 16-byte read buffers with a prefetch depth of 4: sequential reads keep 64 bytes advised ahead
+    buffered_options_t options = { .read_buffer_size = 16, .read_ahead_buffers = 4 };
+    const char *text = "Sequential reads are prefetched ahead of the reader.\n";
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("open 14");
+        return 1;
+    }
+    for (int i = 0; i < 20; i++) {
+        if (write(fd, text, strlen(text)) == -1) {
+            perror("write 14");
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    buffered_file_t *bf = buffered_open_ex(filename, O_RDONLY, 0, &options);
+    if (!bf) {
+        perror("buffered_open_ex 14");
+        return 1;
+    }
+    int passed = 1;
+    char readBuffer[64] = {0};
+    for (int i = 0; i < 20; i++) {
+        ssize_t bytes_read = buffered_read(bf, readBuffer, strlen(text));
+        passed = passed && bytes_read == (ssize_t)strlen(text) && memcmp(readBuffer, text, strlen(text)) == 0;
+    }
+    passed = passed && buffered_read(bf, readBuffer, sizeof(readBuffer)) == 0;
+    int prefetched = bf->readahead_streak > 2 && bf->readahead_left > 0;
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 14");
+        return 1;
+    }
+
+    if (passed && prefetched) {
+        printf("\033[0;32mTEST 14: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 14: FAILED\n\033[0m");
+        printf("\033[0;31mData %s, read-ahead %s\n\033[0m", passed ? "ok" : "wrong", prefetched ? "on" : "off");
+        return -1;
+    }
+    // ============================= END OF TEST 14: Read-ahead ===========================================
+}
+
+int test15(){
+    // ============================= TEST 15: Write buffer growth with uneven writes ======================
+    // 7-byte writes never end exactly at the end of a 16-byte buffer, it still doubles up to 64
+    buffered_options_t options = { .write_buffer_size = 16, .max_buffer_size = 64 };
+    const char *inputTest15 = "abcdefg";
+    char readBuffer[1024] = {0};
+    char expectedOutTest15[1024] = {0};
+    for (int i = 0; i < 40; i++) {
+        strcat(expectedOutTest15, inputTest15);
+    }
+    buffered_file_t *bf = buffered_open_ex(filename, O_RDWR | O_CREAT | O_TRUNC, 0644, &options);
+    if (!bf) {
+        perror("buffered_open_ex 15");
+        return 1;
+    }
+    for (int i = 0; i < 40; i++) {
+        if (buffered_write(bf, inputTest15, strlen(inputTest15)) == -1) {
+            perror("buffered_write 15");
+            buffered_close(bf);
+            return 1;
+        }
+    }
+    size_t grownCapacity = bf->write_capacity;
+    if (buffered_close(bf) == -1) {
+        perror("buffered_close 15");
+        return 1;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("open 15");
+        return 1;
+    }
+    ssize_t bytes_read = read(fd, readBuffer, sizeof(readBuffer) - 1);
+    close(fd);
+    readBuffer[bytes_read > 0 ? bytes_read : 0] = '\0';  // Null-terminate the string
+
+    if (strcmp(readBuffer, expectedOutTest15) == 0 && grownCapacity == 64) {
+        printf("\033[0;32mTEST 15: PASSED\n\033[0m");
+        return 0;
+    } else {
+        printf("\033[0;31mTEST 15: FAILED\n\033[0m");
+        printf("\033[0;32mExpected output: %s \n\033[0m" , expectedOutTest15);
+        printf("\033[0;31mActual output: %s (write buffer grew to %zu bytes)\n\033[0m", readBuffer, grownCapacity);
+        return -1;
+    }
+    // ============================= END OF TEST 15: Write buffer growth with uneven writes ===============
+}
+
 
 int main() {
     int countTestPassed = 0;
@@ -424,7 +926,34 @@ int main() {
     if(test6() == 0){
         countTestPassed++;
     }
-    if (countTestPassed == 6){
+    if (test7() == 0){
+        countTestPassed++;
+    }
+    if (test8() == 0){
+        countTestPassed++;
+    }
+    if (test9() == 0){
+        countTestPassed++;
+    }
+    if (test10() == 0){
+        countTestPassed++;
+    }
+    if (test11() == 0){
+        countTestPassed++;
+    }
+    if (test12() == 0){
+        countTestPassed++;
+    }
+    if (test13() == 0){
+        countTestPassed++;
+    }
+    if (test14() == 0){
+        countTestPassed++;
+    }
+    if (test15() == 0){
+        countTestPassed++;
+    }
+    if (countTestPassed == 15){
         printf("\033[0;32mAll tests passed!\n\033[0m");
     } else {
         printf("\033[0;31mSome tests failed\n\033[0m");
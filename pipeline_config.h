@@ -0,0 +1,184 @@
+#ifndef PIPELINE_CONFIG_H
+#define PIPELINE_CONFIG_H
+
+#include <algorithm>
+#include <istream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "finalfinal.h"
+#include "routing.h"
+
+struct ProducerConfig
+{
+    int id;
+    int numProducts;
+    size_t queueSize;
+};
+
+// Everything read from the config file
+struct PipelineConfig
+{
+    std::vector<ProducerConfig> producers;
+    int coEditorQueueSize = 0;
+    std::vector<int> priorities;
+    SchedulingPolicy policy = SchedulingPolicy::Weighted;
+    size_t queueBudget = 0;
+    std::vector<RouteRule> routes;      // Empty means every category goes to its own co-editor
+};
+
+// Parse "Route <category|producer|contains> <value> = <category>[, <category>...]" into rule.
+// Outputs are indexes into categories.
+inline bool parseRoute(const std::string& line, const std::vector<std::string>& categories, RouteRule& rule, std::string& error)
+{
+    error = "invalid route line: " + line;
+    size_t equals = line.rfind('=');
+    if (equals == std::string::npos)
+    {
+        return false;
+    }
+
+    std::istringstream head(line.substr(0, equals));
+    std::string keyword;
+    std::string kind;
+    head >> keyword >> kind >> std::ws;
+    std::string value;
+    std::getline(head, value);
+    value.erase(value.find_last_not_of(" \t") + 1);
+    if (value.empty())
+    {
+        return false;
+    }
+
+    rule = RouteRule{ RouteRule::Contains, value, 0, {} };
+    if (kind == "category")
+    {
+        rule.kind = RouteRule::Category;
+    }
+    else if (kind == "producer")
+    {
+        rule.kind = RouteRule::Producer;
+        if (!(std::istringstream(value) >> rule.producer))
+        {
+            return false;
+        }
+    }
+    else if (kind != "contains")
+    {
+        return false;
+    }
+
+    std::istringstream outputs(line.substr(equals + 1));
+    std::string name;
+    while (std::getline(outputs >> std::ws, name, ','))
+    {
+        name.erase(name.find_last_not_of(" \t") + 1);
+        auto found = std::find(categories.begin(), categories.end(), name);
+        if (found == categories.end())
+        {
+            error = "unknown route output " + name;
+            return false;
+        }
+        rule.outputs.push_back(found - categories.begin());
+    }
+    return !rule.outputs.empty();
+}
+
+// Read a config file. Return false and describe the problem in error if the file is invalid.
+inline bool parseConfig(std::istream& configFile, const std::vector<std::string>& categories,
+                        PipelineConfig& config, std::string& error)
+{
+    config = PipelineConfig();
+    config.priorities.assign(categories.size(), 1);
+    std::set<int> ids;
+
+    std::string line;
+    // Read the configuration file line by line
+    while (std::getline(configFile, line))
+    {
+        // Route lines may contain any text after the rule kind, so they are recognised first
+        if (line.compare(0, 6, "Route ") == 0)
+        {
+            RouteRule rule;
+            if (!parseRoute(line, categories, rule, error))
+            {
+                return false;
+            }
+            config.routes.push_back(rule);
+        }
+        // Check for the "PRODUCER" keyword, the number after it is the producer id
+        else if (line.find("PRODUCER") != std::string::npos)
+        {
+            ProducerConfig producer = { 0, 0, 0 };
+            if (!(std::istringstream(line.substr(line.find("PRODUCER") + 8)) >> producer.id))
+            {
+                producer.id = static_cast<int>(config.producers.size()) + 1;
+            }
+
+            // Read the number of products
+            std::getline(configFile, line);
+            std::istringstream(line) >> producer.numProducts;
+
+            // Read the queue size
+            int queueSize = 0;
+            std::getline(configFile, line);
+            std::istringstream(line.substr(line.find("=") + 1)) >> queueSize;
+
+            if (queueSize <= 0 || producer.numProducts < 0 || !ids.insert(producer.id).second)
+            {
+                error = "invalid or duplicate PRODUCER " + std::to_string(producer.id);
+                return false;
+            }
+            producer.queueSize = static_cast<size_t>(queueSize);
+            config.producers.push_back(producer);
+        }
+        // Read the queue size for the co-editors
+        else if (line.find("Co-Editor queue size") != std::string::npos)
+        {
+            std::istringstream(line.substr(line.find("=") + 1)) >> config.coEditorQueueSize;
+        }
+        // Read the screen manager scheduling policy: "Screen scheduling = strict" or "weighted"
+        else if (line.find("Screen scheduling") != std::string::npos)
+        {
+            std::string name;
+            std::istringstream(line.substr(line.find("=") + 1)) >> name;
+            if (name != "strict" && name != "weighted")
+            {
+                error = "unknown screen scheduling policy " + name;
+                return false;
+            }
+            config.policy = name == "strict" ? SchedulingPolicy::Strict : SchedulingPolicy::Weighted;
+        }
+        // Read the total number of queue slots the capacity tuner may hand out: "Queue budget = 200"
+        else if (line.find("Queue budget") != std::string::npos)
+        {
+            std::istringstream(line.substr(line.find("=") + 1)) >> config.queueBudget;
+        }
+        // Read a category priority, for example "NEWS priority = 3"
+        else if (line.find("priority") != std::string::npos)
+        {
+            std::string category;
+            std::istringstream(line) >> category;
+            auto found = std::find(categories.begin(), categories.end(), category);
+            int priority = 0;
+            std::istringstream(line.substr(line.find("=") + 1)) >> priority;
+            if (found == categories.end() || priority <= 0)
+            {
+                error = "invalid priority line: " + line;
+                return false;
+            }
+            config.priorities[found - categories.begin()] = priority;
+        }
+    }
+
+    if (config.coEditorQueueSize <= 0)
+    {
+        error = "missing or invalid Co-Editor queue size in config file.";
+        return false;
+    }
+    return true;
+}
+
+#endif
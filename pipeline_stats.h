@@ -0,0 +1,186 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// What a pipeline thread is doing right now
+enum class ThreadState : int
+{
+    Starting,
+    Working,
+    WaitingInput,
+    WaitingOutput,
+    Finished
+};
+
+inline const char* threadStateName(ThreadState state)
+{
+    switch (state)
+    {
+    case ThreadState::Starting: return "starting";
+    case ThreadState::Working: return "working";
+    case ThreadState::WaitingInput: return "waiting-input";
+    case ThreadState::WaitingOutput: return "waiting-output";
+    case ThreadState::Finished: return "finished";
+    }
+    return "unknown";
+}
+
+// Counters of one pipeline thread. Only the owning thread writes them, readers load them relaxed,
+// so updating them costs a plain store and never takes a lock.
+struct ThreadStats
+{
+    ThreadStats(std::string stage, std::string name) : stage(std::move(stage)), name(std::move(name)) {}
+
+    void setState(ThreadState value)
+    {
+        state.store(static_cast<int>(value), std::memory_order_relaxed);
+    }
+
+    void countMessage(uint64_t amount = 1)
+    {
+        processed.store(processed.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    const std::string stage;
+    const std::string name;
+    std::atomic<uint64_t> processed{ 0 };
+    std::atomic<int> state{ static_cast<int>(ThreadState::Starting) };
+};
+
+// Helpers for stages whose stats are optional
+inline void markState(ThreadStats* stats, ThreadState state)
+{
+    if (stats)
+    {
+        stats->setState(state);
+    }
+}
+
+inline void countMessage(ThreadStats* stats, uint64_t amount = 1)
+{
+    if (stats)
+    {
+        stats->countMessage(amount);
+    }
+}
+
+// Latencies bucketed by powers of two microseconds, enough for percentiles without keeping samples.
+// Written by one thread, readable from any thread without locking.
+class LatencyHistogram
+{
+public:
+    void add(std::chrono::microseconds latency)
+    {
+        uint64_t us = static_cast<uint64_t>(latency.count());
+        int bucket = 0;
+        while ((us >> bucket) > 1)
+        {
+            ++bucket;
+        }
+        bump(buckets[bucket], 1);
+        bump(count, 1);
+        bump(total, us);
+        if (us > max.load(std::memory_order_relaxed))
+        {
+            max.store(us, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t samples() const { return count.load(std::memory_order_relaxed); }
+    uint64_t maximum() const { return max.load(std::memory_order_relaxed); }
+
+    uint64_t mean() const
+    {
+        uint64_t n = samples();
+        return n ? total.load(std::memory_order_relaxed) / n : 0;
+    }
+
+    // Upper bound of the bucket holding the given fraction of the samples
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t target = static_cast<uint64_t>(samples() * fraction);
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < 64; ++bucket)
+        {
+            seen += buckets[bucket].load(std::memory_order_relaxed);
+            if (seen > target)
+            {
+                return std::min(maximum(), (uint64_t(2) << bucket) - 1);
+            }
+        }
+        return maximum();
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& counter, uint64_t amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[64] = {};
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> total{ 0 };
+    std::atomic<uint64_t> max{ 0 };
+};
+
+// Registry of everything the stats server reports. Registration takes a lock, the counters themselves do not.
+class PipelineStats
+{
+public:
+    struct Queue
+    {
+        std::string name;
+        std::function<size_t()> depth;
+    };
+
+    struct Latency
+    {
+        std::string name;
+        const LatencyHistogram* histogram;
+    };
+
+    // The returned reference stays valid for the lifetime of the registry
+    ThreadStats& addThread(const std::string& stage, const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.emplace_back(stage, name);
+        return threads.back();
+    }
+
+    void addQueue(const std::string& name, std::function<size_t()> depth)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queues.push_back({ name, std::move(depth) });
+    }
+
+    void addLatency(const std::string& name, const LatencyHistogram& histogram)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        latencies.push_back({ name, &histogram });
+    }
+
+    // Visit the registered items under the registration lock
+    template <typename Visitor>
+    void visit(Visitor&& visitor)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        visitor(threads, queues, latencies);
+    }
+
+private:
+    std::deque<ThreadStats> threads;
+    std::vector<Queue> queues;
+    std::vector<Latency> latencies;
+    std::mutex mutex;
+};
+
+#endif
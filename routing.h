@@ -0,0 +1,281 @@
+#ifndef ROUTING_H
+#define ROUTING_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// One line of the routing table: messages matching the rule are sent to every listed output queue
+struct RouteRule
+{
+    enum Kind
+    {
+        Category,   // The category token of the message equals pattern
+        Producer,   // The message was produced by producer
+        Contains    // The message text contains pattern
+    };
+
+    Kind kind;
+    std::string pattern;
+    int producer;
+    std::vector<size_t> outputs;
+};
+
+// The rules compiled into lookups whose cost does not grow with the number of rules.
+//
+// A message looks like "Producer <id> <CATEGORY> <n>". Category rules are kept in a perfect hash of the
+// category token, producer rules in a hash of the id, and all substrings in one Aho-Corasick automaton,
+// so routing costs two hash probes plus one pass over the text. The result is the union of the outputs
+// of every matching rule, as a bit mask of output queues.
+class RoutingTable
+{
+public:
+    using Mask = uint64_t;
+    enum { MAX_OUTPUTS = 64 };
+
+    struct Token
+    {
+        std::string text;
+        Mask mask;
+    };
+
+    // Route every category to the output queue of the same index
+    static std::vector<RouteRule> byCategory(const std::vector<std::string>& categories)
+    {
+        std::vector<RouteRule> rules;
+        for (size_t i = 0; i < categories.size(); ++i)
+        {
+            rules.push_back({ RouteRule::Category, categories[i], 0, { i } });
+        }
+        return rules;
+    }
+
+    explicit RoutingTable(const std::vector<RouteRule>& rules)
+    {
+        std::vector<Token> categoryTokens;
+        std::vector<std::pair<std::string, Mask>> substrings;
+        for (const RouteRule& rule : rules)
+        {
+            Mask mask = 0;
+            for (size_t output : rule.outputs)
+            {
+                if (output >= MAX_OUTPUTS)
+                {
+                    throw std::invalid_argument("too many routing outputs");
+                }
+                mask |= Mask(1) << output;
+            }
+
+            if (rule.kind == RouteRule::Category)
+            {
+                addToken(categoryTokens, rule.pattern, mask);
+            }
+            else if (rule.kind == RouteRule::Producer)
+            {
+                producers[rule.producer] |= mask;
+            }
+            else if (!rule.pattern.empty())
+            {
+                substrings.push_back({ rule.pattern, mask });
+            }
+        }
+        buildTokenHash(std::move(categoryTokens));
+        buildAutomaton(substrings);
+    }
+
+    Mask route(const std::string& message) const
+    {
+        // Find the id and the category token of "Producer <id> <CATEGORY> ..."
+        const char* text = message.data();
+        const char* end = text + message.size();
+        const char* idStart = static_cast<const char*>(memchr(text, ' ', message.size()));
+        const char* tokenStart = idStart ? static_cast<const char*>(memchr(idStart + 1, ' ', end - idStart - 1)) : nullptr;
+
+        Mask mask = 0;
+        if (tokenStart)
+        {
+            ++tokenStart;
+            const char* tokenEnd = static_cast<const char*>(memchr(tokenStart, ' ', end - tokenStart));
+            mask |= lookupToken(tokenStart, (tokenEnd ? tokenEnd : end) - tokenStart);
+            if (!producers.empty())
+            {
+                mask |= lookupProducer(idStart + 1, tokenStart - 1);
+            }
+        }
+        if (automaton.size() > 1)
+        {
+            mask |= scan(text, end);
+        }
+        return mask;
+    }
+
+    // True when only category rules exist, so the category token alone decides the route
+    bool categoryOnly() const { return producers.empty() && automaton.size() <= 1; }
+
+    const std::vector<Token>& categoryTokens() const { return tokens; }
+
+private:
+    static uint32_t hash(const char* text, size_t length, uint32_t seed)
+    {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < length; ++i)
+        {
+            h = (h ^ static_cast<unsigned char>(text[i])) * 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    static void addToken(std::vector<Token>& tokens, const std::string& text, Mask mask)
+    {
+        for (Token& token : tokens)
+        {
+            if (token.text == text)
+            {
+                token.mask |= mask;
+                return;
+            }
+        }
+        tokens.push_back({ text, mask });
+    }
+
+    // Search a seed and a table size for which no two tokens share a slot
+    void buildTokenHash(std::vector<Token> found)
+    {
+        tokens = std::move(found);
+        for (size_t size = 4; ; size *= 2)
+        {
+            if (size < 2 * tokens.size())
+            {
+                continue;
+            }
+            for (uint32_t seed = 0; seed < 64; ++seed)
+            {
+                slots.assign(size, -1);
+                bool collision = false;
+                for (size_t i = 0; i < tokens.size() && !collision; ++i)
+                {
+                    const std::string& text = tokens[i].text;
+                    int& slot = slots[hash(text.data(), text.size(), seed) & (size - 1)];
+                    collision = slot != -1;
+                    slot = static_cast<int>(i);
+                }
+                if (!collision)
+                {
+                    tokenSeed = seed;
+                    return;
+                }
+            }
+        }
+    }
+
+    Mask lookupToken(const char* text, size_t length) const
+    {
+        int slot = slots[hash(text, length, tokenSeed) & (slots.size() - 1)];
+        if (slot < 0)
+        {
+            return 0;
+        }
+        const std::string& token = tokens[slot].text;
+        return token.size() == length && memcmp(token.data(), text, length) == 0 ? tokens[slot].mask : 0;
+    }
+
+    Mask lookupProducer(const char* begin, const char* end) const
+    {
+        bool negative = begin < end && *begin == '-';
+        int id = 0;
+        for (const char* digit = begin + negative; digit < end; ++digit)
+        {
+            if (*digit < '0' || *digit > '9')
+            {
+                return 0;
+            }
+            id = id * 10 + (*digit - '0');
+        }
+        auto found = producers.find(negative ? -id : id);
+        return found != producers.end() ? found->second : 0;
+    }
+
+    // Build the Aho-Corasick automaton as a complete transition table, state 0 is the root
+    void buildAutomaton(const std::vector<std::pair<std::string, Mask>>& substrings)
+    {
+        automaton.assign(1, State());
+        for (const auto& substring : substrings)
+        {
+            int state = 0;
+            for (char c : substring.first)
+            {
+                unsigned char byte = static_cast<unsigned char>(c);
+                if (automaton[state].next[byte] == 0)
+                {
+                    automaton[state].next[byte] = static_cast<int>(automaton.size());
+                    automaton.push_back(State());
+                }
+                state = automaton[state].next[byte];
+            }
+            automaton[state].mask |= substring.second;
+        }
+
+        // Breadth first, so the failure state of every state is complete before its children are visited
+        std::vector<int> fail(automaton.size(), 0);
+        std::deque<int> pending;
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            if (automaton[0].next[byte] != 0)
+            {
+                pending.push_back(automaton[0].next[byte]);
+            }
+        }
+        while (!pending.empty())
+        {
+            int state = pending.front();
+            pending.pop_front();
+            automaton[state].mask |= automaton[fail[state]].mask;
+            for (int byte = 0; byte < 256; ++byte)
+            {
+                int child = automaton[state].next[byte];
+                if (child != 0)
+                {
+                    fail[child] = automaton[fail[state]].next[byte];
+                    pending.push_back(child);
+                }
+                else
+                {
+                    automaton[state].next[byte] = automaton[fail[state]].next[byte];
+                }
+            }
+        }
+    }
+
+    Mask scan(const char* text, const char* end) const
+    {
+        Mask mask = 0;
+        int state = 0;
+        for (; text < end; ++text)
+        {
+            state = automaton[state].next[static_cast<unsigned char>(*text)];
+            mask |= automaton[state].mask;
+        }
+        return mask;
+    }
+
+    struct State
+    {
+        State() : mask(0) { next.fill(0); }
+
+        std::array<int, 256> next;
+        Mask mask;
+    };
+
+    std::vector<Token> tokens;
+    std::vector<int> slots;
+    uint32_t tokenSeed = 0;
+    std::unordered_map<int, Mask> producers;
+    std::vector<State> automaton;
+};
+
+#endif
@@ -0,0 +1,387 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include "fast_random.h"
+#include "finalfinal.h"
+
+// Discrete-event model of the pipeline.
+//
+// Every stage is a small state machine that runs against a virtual clock: stages are stepped until
+// none of them can make progress at the current time, then the clock jumps to the next time a
+// co-editor finishes editing. Queue blocking is modelled by a stage simply not progressing, so the
+// whole run takes as long as the state machines need and none of the 100 ms edits are slept.
+class PipelineSimulator
+{
+public:
+    using Duration = std::chrono::microseconds;
+
+    struct ProducerSpec
+    {
+        int id;
+        int numProducts;
+        size_t queueSize;
+    };
+
+    struct Report
+    {
+        Duration makespan{ 0 };          // Virtual time until every lane was closed and drained
+        size_t messages = 0;             // Messages displayed
+        double throughput = 0;           // Messages per simulated second
+        Duration meanLatency{ 0 };       // Produce to display latency
+        Duration p50Latency{ 0 };
+        Duration p99Latency{ 0 };
+        Duration maxLatency{ 0 };
+        Duration producerBlocked{ 0 };   // Total time producers waited on a full queue
+    };
+
+    PipelineSimulator(std::vector<ProducerSpec> producers, size_t coEditorQueueSize, Duration editTime)
+        : producerSpecs(std::move(producers)), coEditorQueueSize(coEditorQueueSize), editTime(editTime) {}
+
+    Report run()
+    {
+        reset();
+
+        while (!screen.finished)
+        {
+            bool progress;
+            do
+            {
+                progress = false;
+                for (SimProducer& producer : producers)
+                {
+                    progress |= stepProducer(producer);
+                }
+                progress |= stepDispatcher();
+                for (SimCoEditor& coEditor : coEditors)
+                {
+                    progress |= stepCoEditor(coEditor);
+                }
+                progress |= stepScreen();
+            } while (progress);
+
+            if (screen.finished)
+            {
+                break;
+            }
+
+            // Nothing can move at this instant, jump to the next edit that completes
+            int64_t next = -1;
+            for (const SimCoEditor& coEditor : coEditors)
+            {
+                if (coEditor.state == SimCoEditor::Editing && (next < 0 || coEditor.readyAt < next))
+                {
+                    next = coEditor.readyAt;
+                }
+            }
+            if (next < 0)
+            {
+                throw std::runtime_error("simulation deadlocked");
+            }
+            now = next;
+        }
+
+        return buildReport();
+    }
+
+private:
+    struct SimMessage
+    {
+        int category;       // 0..2
+        int64_t created;    // Virtual time the producer built it
+    };
+
+    struct SimQueue
+    {
+        size_t capacity = 0;
+        bool closed = false;
+        std::deque<SimMessage> items;
+
+        bool drained() const { return closed && items.empty(); }
+
+        bool tryInsert(const SimMessage& message)
+        {
+            if (items.size() >= capacity)
+            {
+                return false;
+            }
+            items.push_back(message);
+            return true;
+        }
+
+        bool tryRemove(SimMessage& message)
+        {
+            if (items.empty())
+            {
+                return false;
+            }
+            message = items.front();
+            items.pop_front();
+            return true;
+        }
+    };
+
+    struct SimProducer
+    {
+        explicit SimProducer(uint64_t seed) : rander(seed) {}
+
+        int remaining;
+        bool finished = false;
+        bool blocked = false;
+        int64_t blockedSince = 0;
+        SimMessage pending{ 0, 0 };
+        SimQueue queue;
+        Xoshiro256 rander;      // Seeded like Producer so the category mix matches
+    };
+
+    struct SimCoEditor
+    {
+        enum State { Idle, Editing, Holding, Finished } state = Idle;
+        SimMessage message{ 0, 0 };
+        int64_t readyAt = 0;
+    };
+
+    struct SimDispatcher
+    {
+        size_t index = 0;
+        bool holding = false;
+        bool finished = false;
+        SimMessage message{ 0, 0 };
+    };
+
+    struct SimScreen
+    {
+        bool finished = false;
+    };
+
+    void reset()
+    {
+        now = 0;
+        producers.clear();
+        for (const ProducerSpec& spec : producerSpecs)
+        {
+            SimProducer producer(Producer::seed(spec.id));
+            producer.remaining = spec.numProducts;
+            producer.queue.capacity = spec.queueSize;
+            producers.push_back(producer);
+        }
+        for (SimQueue& queue : categoryQueues)
+        {
+            queue = SimQueue();
+            queue.capacity = coEditorQueueSize;
+        }
+        for (SimQueue& lane : lanes)
+        {
+            lane = SimQueue();
+            lane.capacity = coEditorQueueSize;
+        }
+        dispatcher = SimDispatcher();
+        for (SimCoEditor& coEditor : coEditors)
+        {
+            coEditor = SimCoEditor();
+        }
+        screen = SimScreen();
+        latencies.clear();
+        producerBlocked = 0;
+    }
+
+    bool stepProducer(SimProducer& producer)
+    {
+        if (producer.finished)
+        {
+            return false;
+        }
+        if (producer.remaining == 0)
+        {
+            producer.queue.closed = true;
+            producer.finished = true;
+            return true;
+        }
+
+        if (!producer.blocked)
+        {
+            producer.pending = SimMessage{ static_cast<int>(producer.rander.below(3)), now };
+        }
+        if (!producer.queue.tryInsert(producer.pending))
+        {
+            if (!producer.blocked)
+            {
+                producer.blocked = true;
+                producer.blockedSince = now;
+            }
+            return false;
+        }
+
+        if (producer.blocked)
+        {
+            producerBlocked += now - producer.blockedSince;
+            producer.blocked = false;
+        }
+        --producer.remaining;
+        return true;
+    }
+
+    bool stepDispatcher()
+    {
+        bool progress = false;
+
+        while (!dispatcher.finished)
+        {
+            if (dispatcher.holding)
+            {
+                if (!categoryQueues[dispatcher.message.category].tryInsert(dispatcher.message))
+                {
+                    return progress;
+                }
+                dispatcher.holding = false;
+                progress = true;
+            }
+
+            // Round robin over the producer queues like Dispatcher does
+            bool found = false;
+            bool allDrained = true;
+            for (size_t tries = 0; tries < producers.size() && !found; ++tries)
+            {
+                SimQueue& queue = producers[dispatcher.index].queue;
+                allDrained = allDrained && queue.drained();
+                if (queue.tryRemove(dispatcher.message))
+                {
+                    found = true;
+                    dispatcher.holding = true;
+                }
+                dispatcher.index = (dispatcher.index + 1) % producers.size();
+            }
+            if (!found)
+            {
+                if (allDrained)
+                {
+                    for (SimQueue& queue : categoryQueues)
+                    {
+                        queue.closed = true;
+                    }
+                    dispatcher.finished = true;
+                    return true;
+                }
+                return progress;
+            }
+            progress = true;
+        }
+        return progress;
+    }
+
+    bool stepCoEditor(SimCoEditor& coEditor)
+    {
+        size_t category = &coEditor - coEditors;
+        bool progress = false;
+
+        while (true)
+        {
+            switch (coEditor.state)
+            {
+            case SimCoEditor::Finished:
+                return progress;
+
+            case SimCoEditor::Editing:
+                if (now < coEditor.readyAt)
+                {
+                    return progress;
+                }
+                coEditor.state = SimCoEditor::Holding;
+                progress = true;
+                break;
+
+            case SimCoEditor::Holding:
+                if (!lanes[category].tryInsert(coEditor.message))
+                {
+                    return progress;
+                }
+                coEditor.state = SimCoEditor::Idle;
+                progress = true;
+                break;
+
+            case SimCoEditor::Idle:
+                if (categoryQueues[category].drained())
+                {
+                    lanes[category].closed = true;
+                    coEditor.state = SimCoEditor::Finished;
+                    return true;
+                }
+                if (!categoryQueues[category].tryRemove(coEditor.message))
+                {
+                    return progress;
+                }
+                coEditor.state = SimCoEditor::Editing;
+                coEditor.readyAt = now + editTime.count();
+                progress = true;
+                break;
+            }
+        }
+    }
+
+    bool stepScreen()
+    {
+        bool progress = false;
+        bool allDrained = true;
+        SimMessage message;
+        for (SimQueue& lane : lanes)
+        {
+            // The screen manager takes no time, so every lane is drained at this instant whatever the policy
+            while (lane.tryRemove(message))
+            {
+                progress = true;
+                latencies.push_back(now - message.created);
+            }
+            allDrained = allDrained && lane.drained();
+        }
+        screen.finished = allDrained;
+        return progress;
+    }
+
+    Report buildReport()
+    {
+        Report report;
+        report.makespan = Duration(now);
+        report.messages = latencies.size();
+        report.producerBlocked = Duration(producerBlocked);
+        if (now > 0)
+        {
+            report.throughput = report.messages * 1e6 / now;
+        }
+        if (!latencies.empty())
+        {
+            std::sort(latencies.begin(), latencies.end());
+            int64_t total = 0;
+            for (int64_t latency : latencies)
+            {
+                total += latency;
+            }
+            report.meanLatency = Duration(total / static_cast<int64_t>(latencies.size()));
+            report.p50Latency = Duration(latencies[latencies.size() / 2]);
+            report.p99Latency = Duration(latencies[(latencies.size() - 1) * 99 / 100]);
+            report.maxLatency = Duration(latencies.back());
+        }
+        return report;
+    }
+
+    std::vector<ProducerSpec> producerSpecs;
+    size_t coEditorQueueSize;
+    Duration editTime;
+
+    int64_t now = 0;
+    std::vector<SimProducer> producers;
+    SimQueue categoryQueues[3];
+    SimQueue lanes[3];
+    SimDispatcher dispatcher;
+    SimCoEditor coEditors[3];
+    SimScreen screen;
+    std::vector<int64_t> latencies;
+    int64_t producerBlocked = 0;
+};
+
+#endif
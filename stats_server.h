@@ -0,0 +1,345 @@
+#ifndef STATS_SERVER_H
+#define STATS_SERVER_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "pipeline_stats.h"
+
+// Serves the pipeline counters on a Unix domain socket.
+//
+// A client connects, optionally sends one line naming the format ("json", the default, or "text"),
+// and receives a single snapshot before the server closes the connection. The snapshot holds queue depths,
+// per-stage message rates, latency percentiles and thread states. Everything runs on the server thread;
+// it only loads the relaxed counters the stages update, so the pipeline never waits for a client.
+class StatsServer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StatsServer(const std::string& path, PipelineStats& stats) : path(path), stats(stats)
+    {
+        if (path.size() >= sizeof(sockaddr_un().sun_path))
+        {
+            throw std::runtime_error("stats socket path too long: " + path);
+        }
+        if (pipe(wakeup) == -1)
+        {
+            throw std::runtime_error("cannot create stats server pipe: " + std::string(strerror(errno)));
+        }
+
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        std::string stale = removeStaleSocket(address);
+        if (!stale.empty())
+        {
+            closeAll();
+            throw std::runtime_error("cannot listen on " + path + ": " + stale);
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener == -1 || bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            std::string reason = strerror(errno);
+            closeAll();
+            throw std::runtime_error("cannot listen on " + path + ": " + reason);
+        }
+        bound = true;
+        if (listen(listener, 8) == -1)
+        {
+            std::string reason = strerror(errno);
+            closeAll();
+            throw std::runtime_error("cannot listen on " + path + ": " + reason);
+        }
+    }
+
+    ~StatsServer()
+    {
+        stop();
+        closeAll();
+    }
+
+    void start()
+    {
+        worker = std::thread([this] { run(); });
+    }
+
+    void stop()
+    {
+        if (worker.joinable())
+        {
+            char byte = 0;
+            if (write(wakeup[1], &byte, 1) == -1)
+            {
+                perror("Error stopping stats server");
+            }
+            worker.join();
+        }
+    }
+
+private:
+    // How often the per-stage rates are recomputed
+    enum { RATE_INTERVAL_MS = 1000 };
+    // How long a client may take to send its format line
+    enum { REQUEST_TIMEOUT_MS = 100 };
+    // How long sending the snapshot may block on a client that does not read, before it is dropped
+    enum { SEND_TIMEOUT_MS = 100 };
+
+    struct Rate
+    {
+        uint64_t processed = 0;
+        double perSecond = 0;
+    };
+
+    // Remove the socket a crashed server left at the path. Anything else there is kept: a file that is not
+    // a socket, or a socket some server still accepts on. Return why the path cannot be used, empty if it can.
+    static std::string removeStaleSocket(const struct sockaddr_un& address)
+    {
+        struct stat st;
+        if (lstat(address.sun_path, &st) == -1)
+        {
+            return errno == ENOENT ? "" : strerror(errno);
+        }
+        if (!S_ISSOCK(st.st_mode))
+        {
+            return "path exists and is not a socket";
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe == -1)
+        {
+            return strerror(errno);
+        }
+        int connected = connect(probe, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address));
+        int error = errno;
+        close(probe);
+        if (connected == 0)
+        {
+            return "another server is listening";
+        }
+        if (error != ECONNREFUSED)
+        {
+            return strerror(error);
+        }
+        if (unlink(address.sun_path) == -1 && errno != ENOENT)
+        {
+            return strerror(errno);
+        }
+        return "";
+    }
+
+    void run()
+    {
+        lastSample = Clock::now();
+        sampleRates();
+        while (true)
+        {
+            struct pollfd fds[2] = { { listener, POLLIN, 0 }, { wakeup[0], POLLIN, 0 } };
+            int ready = poll(fds, 2, RATE_INTERVAL_MS);
+            if (ready > 0 && (fds[1].revents & POLLIN))
+            {
+                break;
+            }
+            if (Clock::now() - lastSample >= std::chrono::milliseconds(RATE_INTERVAL_MS))
+            {
+                sampleRates();
+            }
+            if (ready > 0 && (fds[0].revents & POLLIN))
+            {
+                int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client != -1)
+                {
+                    // A scraper that stops reading costs the other clients at most the timeout
+                    struct timeval timeout = { 0, SEND_TIMEOUT_MS * 1000 };
+                    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                    serve(client);
+                    close(client);
+                }
+            }
+        }
+    }
+
+    // Update the messages per second of every stage from the counters of its threads
+    void sampleRates()
+    {
+        Clock::time_point now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - lastSample).count();
+        std::map<std::string, uint64_t> totals;
+        stats.visit([&](const std::deque<ThreadStats>& threads, const std::vector<PipelineStats::Queue>&,
+                        const std::vector<PipelineStats::Latency>&)
+        {
+            for (const ThreadStats& thread : threads)
+            {
+                totals[thread.stage] += thread.processed.load(std::memory_order_relaxed);
+            }
+        });
+        for (const auto& total : totals)
+        {
+            Rate& rate = rates[total.first];
+            if (seconds > 0)
+            {
+                rate.perSecond = (total.second - rate.processed) / seconds;
+            }
+            rate.processed = total.second;
+        }
+        lastSample = now;
+    }
+
+    void serve(int client)
+    {
+        // The format line is optional, a client that sends nothing gets JSON
+        char request[64] = {};
+        struct pollfd pfd = { client, POLLIN, 0 };
+        if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0)
+        {
+            ssize_t length = recv(client, request, sizeof(request) - 1, 0);
+            request[length > 0 ? length : 0] = '\0';
+        }
+        std::string reply = strncmp(request, "text", 4) == 0 ? text() : json();
+
+        for (size_t sent = 0; sent < reply.size(); )
+        {
+            ssize_t written = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (written <= 0)
+            {
+                break;
+            }
+            sent += static_cast<size_t>(written);
+        }
+    }
+
+    static std::string quoted(const std::string& value)
+    {
+        std::string out = "\"";
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    std::string json()
+    {
+        std::ostringstream out;
+        stats.visit([&](const std::deque<ThreadStats>& threads, const std::vector<PipelineStats::Queue>& queues,
+                        const std::vector<PipelineStats::Latency>& latencies)
+        {
+            out << "{\"queues\":{";
+            for (size_t i = 0; i < queues.size(); ++i)
+            {
+                out << (i ? "," : "") << quoted(queues[i].name) << ":" << queues[i].depth();
+            }
+            out << "},\"stages\":{";
+            bool first = true;
+            for (const auto& rate : rates)
+            {
+                out << (first ? "" : ",") << quoted(rate.first) << ":{\"processed\":" << rate.second.processed
+                    << ",\"rate\":" << rate.second.perSecond << "}";
+                first = false;
+            }
+            out << "},\"latency_us\":{";
+            for (size_t i = 0; i < latencies.size(); ++i)
+            {
+                const LatencyHistogram& histogram = *latencies[i].histogram;
+                out << (i ? "," : "") << quoted(latencies[i].name) << ":{\"samples\":" << histogram.samples()
+                    << ",\"mean\":" << histogram.mean() << ",\"p50\":" << histogram.percentile(0.50)
+                    << ",\"p99\":" << histogram.percentile(0.99) << ",\"max\":" << histogram.maximum() << "}";
+            }
+            out << "},\"threads\":[";
+            for (size_t i = 0; i < threads.size(); ++i)
+            {
+                const ThreadStats& thread = threads[i];
+                out << (i ? "," : "") << "{\"stage\":" << quoted(thread.stage) << ",\"name\":" << quoted(thread.name)
+                    << ",\"state\":\"" << threadStateName(static_cast<ThreadState>(thread.state.load(std::memory_order_relaxed)))
+                    << "\",\"processed\":" << thread.processed.load(std::memory_order_relaxed) << "}";
+            }
+            out << "]}\n";
+        });
+        return out.str();
+    }
+
+    std::string text()
+    {
+        std::ostringstream out;
+        stats.visit([&](const std::deque<ThreadStats>& threads, const std::vector<PipelineStats::Queue>& queues,
+                        const std::vector<PipelineStats::Latency>& latencies)
+        {
+            for (const PipelineStats::Queue& queue : queues)
+            {
+                out << "queue " << queue.name << " depth " << queue.depth() << "\n";
+            }
+            for (const auto& rate : rates)
+            {
+                out << "stage " << rate.first << " processed " << rate.second.processed << " rate "
+                    << rate.second.perSecond << "/s\n";
+            }
+            for (const PipelineStats::Latency& latency : latencies)
+            {
+                const LatencyHistogram& histogram = *latency.histogram;
+                out << "latency " << latency.name << " samples " << histogram.samples() << " mean " << histogram.mean()
+                    << " p50 " << histogram.percentile(0.50) << " p99 " << histogram.percentile(0.99)
+                    << " max " << histogram.maximum() << " us\n";
+            }
+            for (const ThreadStats& thread : threads)
+            {
+                out << "thread " << thread.name << " "
+                    << threadStateName(static_cast<ThreadState>(thread.state.load(std::memory_order_relaxed)))
+                    << " processed " << thread.processed.load(std::memory_order_relaxed) << "\n";
+            }
+        });
+        return out.str();
+    }
+
+    void closeAll()
+    {
+        if (listener != -1)
+        {
+            close(listener);
+            listener = -1;
+        }
+        if (bound)
+        {
+            // Only the socket this server created
+            unlink(path.c_str());
+            bound = false;
+        }
+        for (int& fd : wakeup)
+        {
+            if (fd != -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    std::string path;
+    PipelineStats& stats;
+    int listener = -1;
+    bool bound = false;
+    int wakeup[2] = { -1, -1 };
+    std::thread worker;
+    std::map<std::string, Rate> rates;
+    Clock::time_point lastSample;
+};
+
+#endif